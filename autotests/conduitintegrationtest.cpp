@@ -0,0 +1,356 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "fakeconduitserver.h"
+
+#include "../src/liphrary/server.h"
+#include "../src/liphrary/maniphest.h"
+#include "../src/liphrary/user.h"
+#include "../src/liphrary/project.h"
+
+#include <QObject>
+#include <QTest>
+#include <QSet>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QEventLoop>
+
+using namespace Phrary;
+using namespace Phrary::Maniphest;
+
+static const uint BaseTime = 1420070400;
+static const char APIToken[] = "api-fakeconduitserverapitoken";
+
+class ConduitIntegrationTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+
+    void projectQueryTest();
+    void taskPagingTest();
+    void taskPHIDQueryTest();
+    void modifiedSinceTest();
+    void transactionQueryTest();
+    void userQueryTest();
+    void invalidTokenTest();
+    void conduitErrorTest();
+    void httpErrorTest();
+    void connectionErrorTest();
+    void truncatedResponseTest();
+    void redirectTest();
+    void compressionTest();
+    void latencyTest();
+
+private:
+    template<typename T>
+    KAsync::Future<T> runJob(KAsync::Job<T, Server> job, const Server &server);
+
+    FakeConduitServer mConduit;
+    Server mServer;
+};
+
+template<typename T>
+KAsync::Future<T> ConduitIntegrationTest::runJob(KAsync::Job<T, Server> job, const Server &server)
+{
+    KAsync::FutureWatcher<T> watcher;
+    QEventLoop loop;
+    connect(&watcher, &KAsync::FutureWatcherBase::futureReady, &loop, &QEventLoop::quit);
+    watcher.setFuture(job.exec(server));
+    if (!watcher.future().isFinished()) {
+        loop.exec();
+    }
+    return watcher.future();
+}
+
+void ConduitIntegrationTest::initTestCase()
+{
+    QVERIFY(mConduit.listen());
+    mConduit.setAPIToken(QLatin1String(APIToken));
+    mConduit.generateFixtures(3, 250, 4, 20, 600);
+}
+
+void ConduitIntegrationTest::init()
+{
+    // Each test gets a fresh Server, so no connections or statistics are shared
+    mServer = Server(mConduit.url(), QLatin1String(APIToken));
+    mConduit.resetStatistics();
+    mConduit.setLatency(0);
+    mConduit.setCompressionEnabled(false);
+    mConduit.clearErrors();
+}
+
+void ConduitIntegrationTest::projectQueryTest()
+{
+    const QStringList phids = mConduit.projectPHIDs();
+    const auto future = runJob(Project::query(phids), mServer);
+    QCOMPARE(future.errorCode(), 0);
+
+    const Project::List projects = future.value();
+    QCOMPARE(projects.size(), 3);
+    Q_FOREACH (const Project &project, projects) {
+        QVERIFY(phids.contains(project.phid().toString()));
+        QCOMPARE(project.name(), QStringLiteral("Project %1").arg(project.id()));
+        QCOMPARE(project.dateCreated(), QDateTime::fromTime_t(BaseTime));
+    }
+    QCOMPARE(mConduit.requestCount(QStringLiteral("project.query")), 1);
+}
+
+void ConduitIntegrationTest::taskPagingTest()
+{
+    const QString project = mConduit.projectPHIDs().at(1);
+    QSet<QString> seen;
+    for (int offset = 0; offset < 250; offset += 100) {
+        const auto future = runJob(queryTasksByProject(project, offset, 100, OrderByCreated), mServer);
+        QCOMPARE(future.errorCode(), 0);
+        const Task::List tasks = future.value();
+        QCOMPARE(tasks.size(), qMin(100, 250 - offset));
+        Q_FOREACH (const Task &task, tasks) {
+            QVERIFY(task.projectPHIDs().size() == 1);
+            QCOMPARE(task.projectPHIDs().first().toString(), project);
+            QCOMPARE(task.title(), QStringLiteral("Task number %1 does not \"work\"").arg(task.id()));
+            QCOMPARE(task.isClosed(), task.id() % 4 == 0);
+            QCOMPARE(task.ccPHIDs().size(), 2);
+            QVERIFY(task.description().size() >= 600);
+            seen.insert(QString::fromLatin1(task.phid()));
+        }
+    }
+
+    QCOMPARE(seen, mConduit.taskPHIDs(1).toSet());
+    QCOMPARE(mConduit.requestCount(QStringLiteral("maniphest.query")), 3);
+
+    const auto future = runJob(queryTasksByProject(project, 250, 100, OrderByCreated), mServer);
+    QCOMPARE(future.errorCode(), 0);
+    QVERIFY(future.value().isEmpty());
+}
+
+void ConduitIntegrationTest::taskPHIDQueryTest()
+{
+    const QStringList phids = mConduit.taskPHIDs().mid(100, 250);
+    const auto future = runJob(queryTasksByPHID(phids), mServer);
+    QCOMPARE(future.errorCode(), 0);
+
+    QSet<QString> received;
+    Q_FOREACH (const Task &task, future.value()) {
+        received.insert(QString::fromLatin1(task.phid()));
+    }
+    QCOMPARE(received, phids.toSet());
+    // Split into chunks of at most 100 PHIDs
+    QCOMPARE(mConduit.requestCount(QStringLiteral("maniphest.query")), 3);
+}
+
+void ConduitIntegrationTest::modifiedSinceTest()
+{
+    const QString project = mConduit.projectPHIDs().at(0);
+
+    // Tasks of project 0 are 1 to 250 and were modified an hour after being
+    // created, one minute apart. Tasks 226 to 250 were modified since:
+    const QDateTime since = QDateTime::fromTime_t(BaseTime + 226 * 60 + 3600);
+    auto future = runJob(queryTasksByProjectModifiedSince(project, since), mServer);
+    QCOMPARE(future.errorCode(), 0);
+    QCOMPARE(future.value().size(), 25);
+    Q_FOREACH (const Task &task, future.value()) {
+        QVERIFY(task.dateModified() >= since);
+    }
+    // Pages of 10 and 20 tasks
+    QCOMPARE(mConduit.requestCount(QStringLiteral("maniphest.query")), 2);
+
+    // An old task changes, it becomes the most recently modified one
+    mConduit.resetStatistics();
+    const uint now = BaseTime + 1000000;
+    mConduit.setTaskModified(0, now);
+    future = runJob(queryTasksByProjectModifiedSince(project, QDateTime::fromTime_t(now)), mServer);
+    QCOMPARE(future.errorCode(), 0);
+    QCOMPARE(future.value().size(), 1);
+    QCOMPARE(future.value().first().id(), 1u);
+    QCOMPARE(mConduit.requestCount(QStringLiteral("maniphest.query")), 1);
+}
+
+void ConduitIntegrationTest::transactionQueryTest()
+{
+    const QVector<uint> taskIds = { 1, 2, 300, 750 };
+    const auto future = runJob(queryTransactionsByTask(taskIds), mServer);
+    QCOMPARE(future.errorCode(), 0);
+
+    const Transaction::List transactions = future.value();
+    QCOMPARE(transactions.size(), taskIds.size() * 4);
+    QHash<int, int> perTask;
+    int comments = 0;
+    Q_FOREACH (const Transaction &trx, transactions) {
+        QVERIFY(taskIds.contains(trx.taskId()));
+        perTask[trx.taskId()]++;
+        if (trx.transactionType() == "core:comment") {
+            QVERIFY(!trx.comments().isEmpty());
+            ++comments;
+        }
+        QVERIFY(!trx.authorPHID().isEmpty());
+    }
+    QCOMPARE(perTask.size(), taskIds.size());
+    QCOMPARE(comments, taskIds.size() * 2);
+}
+
+void ConduitIntegrationTest::userQueryTest()
+{
+    QVector<PhidRef> phids;
+    Q_FOREACH (const QString &phid, mConduit.userPHIDs()) {
+        phids.push_back(PhidRef(phid.toLatin1()));
+    }
+
+    const auto future = runJob(User::query(phids), mServer);
+    QCOMPARE(future.errorCode(), 0);
+    const User::List users = future.value();
+    QCOMPARE(users.size(), 20);
+    Q_FOREACH (const User &user, users) {
+        QVERIFY(phids.contains(user.phid()));
+        QVERIFY(user.userName().startsWith(QLatin1String("user")));
+        QCOMPARE(user.roles().size(), 3);
+    }
+}
+
+void ConduitIntegrationTest::invalidTokenTest()
+{
+    const Server server(mConduit.url(), QStringLiteral("api-wrongtoken"));
+    const auto future = runJob(Project::query(mConduit.projectPHIDs()), server);
+    QVERIFY(future.errorCode() != 0);
+    QVERIFY(future.value().isEmpty());
+}
+
+void ConduitIntegrationTest::conduitErrorTest()
+{
+    mConduit.injectError(QStringLiteral("maniphest.query"), FakeConduitServer::ConduitError);
+    auto future = runJob(queryTasksByProject(mConduit.projectPHIDs().at(0), 0, 10), mServer);
+    QVERIFY(future.errorCode() != 0);
+    QVERIFY(future.errorMessage().contains(QLatin1String("Injected error")));
+
+    // Only the next request fails
+    future = runJob(queryTasksByProject(mConduit.projectPHIDs().at(0), 0, 10), mServer);
+    QCOMPARE(future.errorCode(), 0);
+    QCOMPARE(future.value().size(), 10);
+}
+
+void ConduitIntegrationTest::httpErrorTest()
+{
+    mConduit.injectError(QStringLiteral("user.query"), FakeConduitServer::HttpError);
+    auto future = runJob(User::query({ PhidRef(mConduit.userPHIDs().first().toLatin1()) }), mServer);
+    QVERIFY(future.errorCode() != 0);
+
+    future = runJob(User::query({ PhidRef(mConduit.userPHIDs().first().toLatin1()) }), mServer);
+    QCOMPARE(future.errorCode(), 0);
+    QCOMPARE(future.value().size(), 1);
+}
+
+void ConduitIntegrationTest::connectionErrorTest()
+{
+    // QNAM silently resends a request when the connection is closed before
+    // any part of the response has arrived, at most three times
+    mConduit.injectError(QStringLiteral("maniphest.query"), FakeConduitServer::ConnectionError, 8);
+    auto future = runJob(queryTasksByProject(mConduit.projectPHIDs().at(0), 0, 10), mServer);
+    QVERIFY(future.errorCode() != 0);
+    const int attempts = mConduit.requestCount(QStringLiteral("maniphest.query"));
+    QVERIFY2(attempts > 1 && attempts <= 4, qPrintable(QString::number(attempts)));
+    mConduit.clearErrors();
+
+    mConduit.resetStatistics();
+    future = runJob(queryTasksByProject(mConduit.projectPHIDs().at(0), 0, 10), mServer);
+    QCOMPARE(future.errorCode(), 0);
+    QCOMPARE(future.value().size(), 10);
+    QCOMPARE(mConduit.requestCount(QStringLiteral("maniphest.query")), 1);
+}
+
+void ConduitIntegrationTest::truncatedResponseTest()
+{
+    // A response broken off halfway is not resent, so the failure of one of
+    // the chunks fails the whole query
+    mConduit.injectError(QStringLiteral("maniphest.query"), FakeConduitServer::TruncatedResponse);
+    auto future = runJob(queryTasksByPHID(mConduit.taskPHIDs().mid(0, 200)), mServer);
+    QVERIFY(future.errorCode() != 0);
+    QCOMPARE(mConduit.requestCount(QStringLiteral("maniphest.query")), 2);
+
+    mConduit.resetStatistics();
+    future = runJob(queryTasksByPHID(mConduit.taskPHIDs().mid(0, 200)), mServer);
+    QCOMPARE(future.errorCode(), 0);
+    QCOMPARE(future.value().size(), 200);
+    QCOMPARE(mConduit.requestCount(QStringLiteral("maniphest.query")), 2);
+}
+
+void ConduitIntegrationTest::redirectTest()
+{
+    // The request is posted again to the new location, with its parameters
+    const QString project = mConduit.projectPHIDs().at(1);
+    mConduit.injectError(QStringLiteral("maniphest.query"), FakeConduitServer::Redirect, 2);
+    auto future = runJob(queryTasksByProject(project, 0, 100), mServer);
+    QCOMPARE(future.errorCode(), 0);
+    QCOMPARE(future.value().size(), 100);
+    QCOMPARE(mConduit.requestCount(QStringLiteral("maniphest.query")), 3);
+
+    // Endless redirects eventually fail
+    mConduit.resetStatistics();
+    mConduit.injectError(QStringLiteral("maniphest.query"), FakeConduitServer::Redirect, 100);
+    future = runJob(queryTasksByProject(project, 0, 100), mServer);
+    QVERIFY(future.errorCode() != 0);
+    QCOMPARE(mConduit.requestCount(QStringLiteral("maniphest.query")), 6);
+}
+
+void ConduitIntegrationTest::compressionTest()
+{
+    const QString project = mConduit.projectPHIDs().at(2);
+    const auto plain = runJob(queryTasksByProject(project, 0, 100), mServer);
+    QCOMPARE(plain.errorCode(), 0);
+    const qint64 plainBytes = mConduit.bytesSent();
+
+    mConduit.resetStatistics();
+    mConduit.setCompressionEnabled(true);
+    const auto compressed = runJob(queryTasksByProject(project, 0, 100), mServer);
+    QCOMPARE(compressed.errorCode(), 0);
+    QVERIFY(mConduit.bytesSent() * 4 < plainBytes);
+
+    QCOMPARE(compressed.value().size(), plain.value().size());
+    QHash<QString, QString> descriptions;
+    Q_FOREACH (const Task &task, plain.value()) {
+        descriptions.insert(QString::fromLatin1(task.phid()), task.description());
+    }
+    Q_FOREACH (const Task &task, compressed.value()) {
+        QCOMPARE(task.description(), descriptions.value(QString::fromLatin1(task.phid())));
+    }
+
+    const TransferStatistics stats = mServer.transferStatistics().value(QStringLiteral("maniphest.query"));
+    QVERIFY(stats.bytesDecoded > stats.bytesReceived);
+}
+
+void ConduitIntegrationTest::latencyTest()
+{
+    mConduit.setLatency(200);
+
+    // Chunks are sent concurrently, so three of them take about as long as one
+    QElapsedTimer timer;
+    timer.start();
+    const auto future = runJob(queryTasksByPHID(mConduit.taskPHIDs().mid(0, 300)), mServer);
+    QCOMPARE(future.errorCode(), 0);
+    QCOMPARE(future.value().size(), 300);
+    QVERIFY(timer.elapsed() >= 200);
+    QVERIFY(timer.elapsed() < 3 * 200);
+}
+
+QTEST_GUILESS_MAIN(ConduitIntegrationTest)
+
+#include "conduitintegrationtest.moc"
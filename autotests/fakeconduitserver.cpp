@@ -0,0 +1,672 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "fakeconduitserver.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QUrlQuery>
+#include <QVector>
+
+#include <algorithm>
+
+namespace {
+
+static const uint BaseTime = 1420070400; // 2015-01-01
+
+struct PriorityInfo {
+    const char *name;
+    const char *color;
+};
+
+static const PriorityInfo Priorities[] = {
+    { "Unbreak Now!", "pink" },
+    { "Needs Triage", "violet" },
+    { "High",         "red" },
+    { "Normal",       "orange" },
+    { "Low",          "yellow" },
+    { "Wishlist",     "sky" }
+};
+
+// Building blocks of the generated descriptions and comments, "%1" is
+// replaced with a number derived from the task
+static const char *const Paragraphs[] = {
+    "Steps to reproduce: open the **calendar**, switch to //week view// and look at {T%1}.\n",
+    "See https://bugs.example.org/show_bug.cgi?id=%1 for the original report.\n",
+    "  $ akonadictl restart\n  $ korganizer --debug %1\n",
+    "```\n#0  0x00007f9d768a05b9 in QObject::disconnect() () from /usr/lib/libQt5Core.so.5\n#1  %1 in ?? ()\n```\n",
+    "Caf\xc3\xa9 __underlined__ ~~deleted~~ ##monospace## and [[https://example.org/%1|a \"link\"]].\n",
+    "= Expected result =\nThe event %1 is shown in the agenda, as described in {D%1}.\n"
+};
+static const int ParagraphCount = sizeof(Paragraphs) / sizeof(*Paragraphs);
+
+static QByteArray phid(const char *type, int number)
+{
+    return QByteArray("PHID-") + type + '-' + QByteArray::number(number).rightJustified(20, '0');
+}
+
+static int phidNumber(const QByteArray &phid, const char *type)
+{
+    const QByteArray prefix = QByteArray("PHID-") + type + '-';
+    if (!phid.startsWith(prefix)) {
+        return -1;
+    }
+    bool ok = false;
+    const int number = phid.mid(prefix.size()).toInt(&ok);
+    return ok ? number : -1;
+}
+
+static void writeString(QByteArray &out, const QByteArray &utf8)
+{
+    out += '"';
+    for (const char c : utf8) {
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+static void writeMember(QByteArray &out, const char *key, const QByteArray &value)
+{
+    writeString(out, key);
+    out += ':';
+    writeString(out, value);
+    out += ',';
+}
+
+static void writePhidList(QByteArray &out, const char *key, const QVector<QByteArray> &phids)
+{
+    writeString(out, key);
+    out += ":[";
+    for (int i = 0; i < phids.size(); ++i) {
+        if (i > 0) {
+            out += ',';
+        }
+        writeString(out, phids[i]);
+    }
+    out += "],";
+}
+
+static QByteArray generateText(int seed, int size)
+{
+    QByteArray text;
+    text.reserve(size + 128);
+    for (int i = 0; text.size() < size; ++i) {
+        text += QByteArray(Paragraphs[(seed + i) % ParagraphCount]).replace("%1", QByteArray::number(seed + i));
+    }
+    return text;
+}
+
+static QStringList stringList(const QJsonValue &value)
+{
+    QStringList list;
+    Q_FOREACH (const QJsonValue &v, value.toArray()) {
+        list.push_back(v.toString());
+    }
+    return list;
+}
+
+}
+
+FakeConduitServer::FakeConduitServer(QObject *parent)
+    : QObject(parent)
+    , mServer(new QTcpServer(this))
+    , mFixtures(Fixtures{ 0, 0, 0, 0, 0 })
+    , mLatency(0)
+    , mCompression(false)
+    , mBytesSent(0)
+{
+    connect(mServer, &QTcpServer::newConnection, this, &FakeConduitServer::onNewConnection);
+}
+
+FakeConduitServer::~FakeConduitServer()
+{
+}
+
+bool FakeConduitServer::listen(quint16 port)
+{
+    return mServer->listen(QHostAddress::LocalHost, port);
+}
+
+QString FakeConduitServer::url() const
+{
+    return QStringLiteral("http://127.0.0.1:%1").arg(mServer->serverPort());
+}
+
+void FakeConduitServer::setAPIToken(const QString &token)
+{
+    mAPIToken = token;
+}
+
+void FakeConduitServer::generateFixtures(int projects, int tasksPerProject, int transactionsPerTask,
+                                         int users, int descriptionSize)
+{
+    mFixtures = Fixtures{ projects, tasksPerProject, transactionsPerTask, qMax(1, users), descriptionSize };
+    mModified.clear();
+    mProjects.clear();
+}
+
+QStringList FakeConduitServer::projectPHIDs() const
+{
+    QStringList phids;
+    for (int i = 0; i < mFixtures.projects; ++i) {
+        phids.push_back(QString::fromLatin1(phid("PROJ", i + 1)));
+    }
+    return phids;
+}
+
+QStringList FakeConduitServer::taskPHIDs(int project) const
+{
+    const int first = project < 0 ? 0 : project * mFixtures.tasksPerProject;
+    const int last = project < 0 ? taskCount() : first + mFixtures.tasksPerProject;
+    QStringList phids;
+    if (project > -1 && !mProjects.isEmpty()) {
+        for (int i = 0; i < taskCount(); ++i) {
+            if (taskProject(i) == project) {
+                phids.push_back(QString::fromLatin1(phid("TASK", i + 1)));
+            }
+        }
+        return phids;
+    }
+
+    phids.reserve(last - first);
+    for (int i = first; i < last; ++i) {
+        phids.push_back(QString::fromLatin1(phid("TASK", i + 1)));
+    }
+    return phids;
+}
+
+QStringList FakeConduitServer::userPHIDs() const
+{
+    QStringList phids;
+    for (int i = 0; i < mFixtures.users; ++i) {
+        phids.push_back(QString::fromLatin1(phid("USER", i + 1)));
+    }
+    return phids;
+}
+
+int FakeConduitServer::taskCount() const
+{
+    return mFixtures.projects * mFixtures.tasksPerProject;
+}
+
+void FakeConduitServer::setTaskModified(int index, uint time)
+{
+    mModified.insert(index, time);
+}
+
+void FakeConduitServer::setTaskProject(int index, int project)
+{
+    mProjects.insert(index, project);
+}
+
+void FakeConduitServer::setLatency(int msecs)
+{
+    mLatency = msecs;
+}
+
+int FakeConduitServer::latency() const
+{
+    return mLatency;
+}
+
+void FakeConduitServer::setCompressionEnabled(bool enabled)
+{
+    mCompression = enabled;
+}
+
+bool FakeConduitServer::isCompressionEnabled() const
+{
+    return mCompression;
+}
+
+void FakeConduitServer::injectError(const QString &method, ErrorType type, int count)
+{
+    mErrors.insert(method, qMakePair(type, count));
+}
+
+void FakeConduitServer::clearErrors()
+{
+    mErrors.clear();
+}
+
+int FakeConduitServer::requestCount(const QString &method) const
+{
+    if (!method.isEmpty()) {
+        return mRequests.value(method);
+    }
+    int count = 0;
+    for (auto it = mRequests.cbegin(), end = mRequests.cend(); it != end; ++it) {
+        count += *it;
+    }
+    return count;
+}
+
+qint64 FakeConduitServer::bytesSent() const
+{
+    return mBytesSent;
+}
+
+void FakeConduitServer::resetStatistics()
+{
+    mRequests.clear();
+    mBytesSent = 0;
+}
+
+void FakeConduitServer::onNewConnection()
+{
+    while (QTcpSocket *socket = mServer->nextPendingConnection()) {
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { onReadyRead(socket); });
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+            mBuffers.remove(socket);
+            socket->deleteLater();
+        });
+    }
+}
+
+void FakeConduitServer::onReadyRead(QTcpSocket *socket)
+{
+    QByteArray &buffer = mBuffers[socket];
+    buffer += socket->readAll();
+
+    // The connections are kept alive, so there may be several requests
+    // one after another
+    Q_FOREVER {
+        const int headerEnd = buffer.indexOf("\r\n\r\n");
+        if (headerEnd == -1) {
+            return;
+        }
+
+        const QList<QByteArray> lines = buffer.left(headerEnd).split('\n');
+        const QList<QByteArray> requestLine = lines.first().trimmed().split(' ');
+        int contentLength = 0;
+        for (int i = 1; i < lines.size(); ++i) {
+            const int colon = lines[i].indexOf(':');
+            if (colon > -1 && lines[i].left(colon).trimmed().toLower() == "content-length") {
+                contentLength = lines[i].mid(colon + 1).trimmed().toInt();
+            }
+        }
+
+        const int requestSize = headerEnd + 4 + contentLength;
+        if (buffer.size() < requestSize) {
+            return;
+        }
+
+        const QByteArray body = buffer.mid(headerEnd + 4, contentLength);
+        buffer.remove(0, requestSize);
+        handleRequest(socket, requestLine.value(1), body);
+    }
+}
+
+void FakeConduitServer::handleRequest(QTcpSocket *socket, const QByteArray &path, const QByteArray &body)
+{
+    const QString method = QString::fromLatin1(path.mid(path.lastIndexOf('/') + 1));
+    mRequests[method]++;
+
+    const QUrlQuery form(QString::fromLatin1(body));
+    const QByteArray paramsJson = form.queryItemValue(QStringLiteral("params"), QUrl::FullyDecoded).toUtf8();
+    const QJsonObject params = QJsonDocument::fromJson(paramsJson).object();
+
+    auto error = mErrors.find(method);
+    if (error == mErrors.end()) {
+        error = mErrors.find(QString());
+    }
+    if (error != mErrors.end()) {
+        const ErrorType type = error->first;
+        if (--error->second == 0) {
+            mErrors.erase(error);
+        }
+        switch (type) {
+        case ConduitError:
+            sendResponse(socket, 200, "{\"result\":null,\"error_code\":\"ERR-CONDUIT-CORE\","
+                                      "\"error_info\":\"Injected error\"}");
+            return;
+        case HttpError:
+            sendResponse(socket, 500, "{}");
+            return;
+        case ConnectionError:
+            socket->abort();
+            return;
+        case TruncatedResponse: {
+            const QByteArray json = "{\"result\":" + dispatch(method, params) + ",\"error_code\":null,\"error_info\":null}";
+            const QByteArray response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: "
+                                        + QByteArray::number(json.size()) + "\r\n\r\n" + json.left(json.size() / 2);
+            mBytesSent += response.size();
+            socket->write(response);
+            // Waits until the partial response has been written
+            socket->disconnectFromHost();
+            return;
+        }
+        case Redirect: {
+            const QByteArray html = "<html><body>Moved</body></html>";
+            const QByteArray response = "HTTP/1.1 301 Moved Permanently\r\nLocation: " + path
+                                        + "\r\nContent-Type: text/html\r\nConnection: keep-alive\r\nContent-Length: "
+                                        + QByteArray::number(html.size()) + "\r\n\r\n" + html;
+            mBytesSent += response.size();
+            socket->write(response);
+            return;
+        }
+        }
+    }
+
+    const QString token = params.value(QStringLiteral("__conduit__")).toObject().value(QStringLiteral("token")).toString();
+    if (!mAPIToken.isEmpty() && token != mAPIToken) {
+        sendResponse(socket, 200, "{\"result\":null,\"error_code\":\"ERR-INVALID-AUTH\","
+                                  "\"error_info\":\"API token is not valid\"}");
+        return;
+    }
+
+    const QByteArray result = dispatch(method, params);
+    if (result.isNull()) {
+        sendResponse(socket, 200, "{\"result\":null,\"error_code\":\"ERR-CONDUIT-CALL\","
+                                  "\"error_info\":\"Conduit method does not exist\"}");
+        return;
+    }
+
+    sendResponse(socket, 200, "{\"result\":" + result + ",\"error_code\":null,\"error_info\":null}");
+}
+
+void FakeConduitServer::sendResponse(QTcpSocket *socket, int status, const QByteArray &json)
+{
+    QByteArray body = json;
+    QByteArray headers = "HTTP/1.1 " + QByteArray::number(status) + (status == 200 ? " OK" : " Internal Server Error")
+                         + "\r\nContent-Type: application/json\r\nConnection: keep-alive\r\n";
+    if (mCompression) {
+        // qCompress() produces a zlib stream prefixed with the uncompressed size,
+        // which is what HTTP calls "deflate" once the prefix is gone
+        body = qCompress(json).mid(4);
+        headers += "Content-Encoding: deflate\r\n";
+    }
+    headers += "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n";
+
+    const QByteArray response = headers + body;
+    mBytesSent += response.size();
+    if (mLatency > 0) {
+        QTimer::singleShot(mLatency, socket, [socket, response]() {
+            socket->write(response);
+        });
+    } else {
+        socket->write(response);
+    }
+}
+
+QByteArray FakeConduitServer::dispatch(const QString &method, const QJsonObject &params) const
+{
+    if (method == QLatin1String("maniphest.query")) {
+        return queryTasks(params);
+    } else if (method == QLatin1String("maniphest.gettasktransactions")) {
+        return queryTransactions(params);
+    } else if (method == QLatin1String("user.query")) {
+        return queryUsers(params);
+    } else if (method == QLatin1String("project.query")) {
+        return queryProjects(params);
+    }
+    return QByteArray();
+}
+
+int FakeConduitServer::taskIndex(const QByteArray &phid) const
+{
+    const int number = phidNumber(phid, "TASK");
+    return number > 0 && number <= taskCount() ? number - 1 : -1;
+}
+
+uint FakeConduitServer::taskModified(int index) const
+{
+    return mModified.value(index, BaseTime + (index + 1) * 60 + 3600);
+}
+
+int FakeConduitServer::taskProject(int index) const
+{
+    return mProjects.value(index, index / qMax(1, mFixtures.tasksPerProject));
+}
+
+QByteArray FakeConduitServer::queryTasks(const QJsonObject &params) const
+{
+    QVector<int> tasks;
+    const QStringList phids = stringList(params.value(QStringLiteral("phids")));
+    const QStringList projects = stringList(params.value(QStringLiteral("projectPHIDs")));
+    if (!phids.isEmpty()) {
+        Q_FOREACH (const QString &phid, phids) {
+            const int index = taskIndex(phid.toLatin1());
+            if (index > -1) {
+                tasks.push_back(index);
+            }
+        }
+    } else {
+        int first = 0;
+        int last = taskCount();
+        const int project = projects.isEmpty() ? -1 : phidNumber(projects.first().toLatin1(), "PROJ") - 1;
+        if (!projects.isEmpty() && mProjects.isEmpty()) {
+            first = qBound(0, project * mFixtures.tasksPerProject, taskCount());
+            last = project < 0 ? first : qMin(first + mFixtures.tasksPerProject, taskCount());
+        }
+        // Newest first, which is also the modification order unless some
+        // tasks were explicitly modified
+        tasks.reserve(last - first);
+        for (int i = last - 1; i >= first; --i) {
+            // Once tasks were moved, the project ranges no longer hold
+            if (projects.isEmpty() || mProjects.isEmpty() || taskProject(i) == project) {
+                tasks.push_back(i);
+            }
+        }
+    }
+
+    if (params.value(QStringLiteral("order")).toString() == QLatin1String("order-modified") && !mModified.isEmpty()) {
+        std::stable_sort(tasks.begin(), tasks.end(), [this](int a, int b) {
+            return taskModified(a) > taskModified(b);
+        });
+    }
+
+    const int offset = qMax(0, params.value(QStringLiteral("offset")).toInt());
+    const int limit = params.value(QStringLiteral("limit")).toInt(100);
+    tasks = tasks.mid(offset, limit);
+    if (tasks.isEmpty()) {
+        // PHP encodes empty maps as lists
+        return "[]";
+    }
+
+    QByteArray out;
+    out.reserve(tasks.size() * (mFixtures.descriptionSize + 1024));
+    out += '{';
+    for (int i = 0; i < tasks.size(); ++i) {
+        if (i > 0) {
+            out += ',';
+        }
+        writeTask(out, tasks[i]);
+    }
+    out += '}';
+    return out;
+}
+
+void FakeConduitServer::writeTask(QByteArray &out, int index) const
+{
+    const int id = index + 1;
+    const QByteArray taskPhid = phid("TASK", id);
+    const PriorityInfo &priority = Priorities[id % 6];
+    const bool closed = id % 4 == 0;
+
+    writeString(out, taskPhid);
+    out += ":{";
+    writeMember(out, "id", QByteArray::number(id));
+    writeMember(out, "phid", taskPhid);
+    writeMember(out, "authorPHID", phid("USER", id % mFixtures.users + 1));
+    writeMember(out, "ownerPHID", phid("USER", (id + 1) % mFixtures.users + 1));
+    writePhidList(out, "ccPHIDs", { phid("USER", (id + 2) % mFixtures.users + 1),
+                                    phid("USER", (id + 3) % mFixtures.users + 1) });
+    writeMember(out, "status", closed ? "resolved" : "open");
+    writeMember(out, "statusName", closed ? "Resolved" : "Open");
+    out += closed ? "\"isClosed\":true," : "\"isClosed\":false,";
+    writeMember(out, "priority", priority.name);
+    writeMember(out, "priorityColor", priority.color);
+    writeMember(out, "title", "Task number " + QByteArray::number(id) + " does not \"work\"");
+    writeMember(out, "description", generateText(id, mFixtures.descriptionSize));
+    writePhidList(out, "projectPHIDs", { phid("PROJ", taskProject(index) + 1) });
+    writeMember(out, "uri", "https://phabricator.example.org/T" + QByteArray::number(id));
+    out += "\"auxiliary\":{\"std:maniphest:example:points\":null},";
+    writeMember(out, "objectName", "T" + QByteArray::number(id));
+    writeMember(out, "dateCreated", QByteArray::number(BaseTime + id * 60));
+    writeMember(out, "dateModified", QByteArray::number(taskModified(index)));
+    out += "\"dependsOnTaskPHIDs\":[]}";
+}
+
+QByteArray FakeConduitServer::queryTransactions(const QJsonObject &params) const
+{
+    QByteArray out;
+    out += '{';
+    bool first = true;
+    Q_FOREACH (const QJsonValue &value, params.value(QStringLiteral("ids")).toArray()) {
+        const int index = value.toInt() - 1;
+        if (index < 0 || index >= taskCount()) {
+            continue;
+        }
+        if (!first) {
+            out += ',';
+        }
+        first = false;
+        writeTransactions(out, index);
+    }
+    if (first) {
+        return "[]";
+    }
+    out += '}';
+    return out;
+}
+
+void FakeConduitServer::writeTransactions(QByteArray &out, int index) const
+{
+    const int id = index + 1;
+    writeString(out, QByteArray::number(id));
+    out += ":[";
+    // Newest first, like Conduit does
+    for (int i = mFixtures.transactionsPerTask - 1; i >= 0; --i) {
+        const bool comment = i % 2 == 1;
+        out += '{';
+        writeMember(out, "taskID", QByteArray::number(id));
+        writeMember(out, "transactionID", QByteArray::number(id * 100 + i));
+        writeMember(out, "transactionPHID", phid("XACT", id * 100 + i));
+        writeMember(out, "transactionType", comment ? "core:comment" : "status");
+        out += "\"oldValue\":null,\"newValue\":null,";
+        if (comment) {
+            writeMember(out, "comments", generateText(id + i, mFixtures.descriptionSize / 4));
+        } else {
+            out += "\"comments\":null,";
+        }
+        writeMember(out, "authorPHID", phid("USER", (id + i) % mFixtures.users + 1));
+        out += "\"dateCreated\":";
+        writeString(out, QByteArray::number(BaseTime + id * 60 + i * 600));
+        out += '}';
+        if (i > 0) {
+            out += ',';
+        }
+    }
+    out += ']';
+}
+
+QByteArray FakeConduitServer::queryUsers(const QJsonObject &params) const
+{
+    QByteArray out;
+    out += '[';
+    const QStringList phids = stringList(params.value(QStringLiteral("phids")));
+    const int limit = params.value(QStringLiteral("limit")).toInt(100);
+    int count = 0;
+    Q_FOREACH (const QString &userPhid, phids) {
+        const int number = phidNumber(userPhid.toLatin1(), "USER");
+        if (number < 1 || number > mFixtures.users || count == limit) {
+            continue;
+        }
+        if (count++ > 0) {
+            out += ',';
+        }
+        writeUser(out, number - 1);
+    }
+    out += ']';
+    return out;
+}
+
+void FakeConduitServer::writeUser(QByteArray &out, int index) const
+{
+    const QByteArray number = QByteArray::number(index + 1);
+    out += '{';
+    writeMember(out, "phid", phid("USER", index + 1));
+    writeMember(out, "userName", "user" + number);
+    writeMember(out, "realName", "User " + number);
+    writeMember(out, "image", "https://phabricator.example.org/file/data/profile-" + number + ".png");
+    writeMember(out, "uri", "https://phabricator.example.org/p/user" + number + '/');
+    out += "\"roles\":[\"verified\",\"approved\",\"activated\"]}";
+}
+
+QByteArray FakeConduitServer::queryProjects(const QJsonObject &params) const
+{
+    QByteArray out;
+    out += "{\"data\":";
+    const QStringList phids = stringList(params.value(QStringLiteral("phids")));
+    QByteArray data;
+    Q_FOREACH (const QString &projectPhid, phids) {
+        const int number = phidNumber(projectPhid.toLatin1(), "PROJ");
+        if (number < 1 || number > mFixtures.projects) {
+            continue;
+        }
+        data += data.isEmpty() ? '{' : ',';
+        writeProject(data, number - 1);
+    }
+    out += data.isEmpty() ? QByteArray("[]") : data + '}';
+    out += ",\"slugMap\":[],\"cursor\":{\"limit\":100,\"after\":null,\"before\":null}}";
+    return out;
+}
+
+void FakeConduitServer::writeProject(QByteArray &out, int index) const
+{
+    const QByteArray projectPhid = phid("PROJ", index + 1);
+    const QByteArray number = QByteArray::number(index + 1);
+    writeString(out, projectPhid);
+    out += ":{";
+    writeMember(out, "id", number);
+    writeMember(out, "phid", projectPhid);
+    writeMember(out, "name", "Project " + number);
+    writeMember(out, "profileImagePHID", phid("FILE", index + 1));
+    writeMember(out, "icon", "project");
+    writeMember(out, "color", "blue");
+    writePhidList(out, "members", { phid("USER", index % mFixtures.users + 1) });
+    out += "\"slugs\":[";
+    writeString(out, "project_" + number);
+    out += "],";
+    writeMember(out, "dateCreated", QByteArray::number(BaseTime));
+    out += "\"dateModified\":";
+    writeString(out, QByteArray::number(BaseTime));
+    out += '}';
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef FAKECONDUITSERVER_H
+#define FAKECONDUITSERVER_H
+
+#include <QObject>
+#include <QHash>
+#include <QJsonObject>
+#include <QStringList>
+
+class QTcpServer;
+class QTcpSocket;
+
+/**
+ * A local stand-in for the Conduit API of a Phabricator instance.
+ *
+ * Serves maniphest.query, maniphest.gettasktransactions, user.query and
+ * project.query over plain HTTP/1.1 from generated fixtures. The fixtures
+ * are deterministic and rendered on the fly, so even instances with hundreds
+ * of thousands of tasks cost no memory. Latency, compression and errors can
+ * be injected to exercise the client in conditions close to a real server.
+ */
+class FakeConduitServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum ErrorType {
+        ConduitError,   ///< HTTP 200 with a Conduit error_code
+        HttpError,      ///< HTTP 500
+        ConnectionError,  ///< The connection is closed without a response
+        TruncatedResponse, ///< The connection is closed after half of the response
+        Redirect          ///< HTTP 301 to the same URL
+    };
+
+    explicit FakeConduitServer(QObject *parent = Q_NULLPTR);
+    ~FakeConduitServer();
+
+    /**
+     * Starts listening on a random port on the loopback interface.
+     */
+    bool listen(quint16 port = 0);
+    QString url() const;
+
+    /**
+     * Requests with a different API token are rejected, an empty token
+     * accepts any.
+     */
+    void setAPIToken(const QString &token);
+
+    /**
+     * Generates @p projects projects with @p tasksPerProject tasks each. Every
+     * task has @p transactionsPerTask transactions, half of them comments,
+     * and a description of roughly @p descriptionSize characters of markup.
+     */
+    void generateFixtures(int projects, int tasksPerProject, int transactionsPerTask = 4,
+                          int users = 50, int descriptionSize = 400);
+
+    QStringList projectPHIDs() const;
+    QStringList taskPHIDs(int project = -1) const;
+    QStringList userPHIDs() const;
+    int taskCount() const;
+
+    /**
+     * Marks the task at @p index as modified at @p time (seconds since epoch).
+     */
+    void setTaskModified(int index, uint time);
+
+    /**
+     * Moves the task at @p index to project number @p project. Like on a real
+     * server the move should come with a setTaskModified().
+     */
+    void setTaskProject(int index, int project);
+
+    /**
+     * Delays each response by @p msecs milliseconds.
+     */
+    void setLatency(int msecs);
+    int latency() const;
+
+    /**
+     * Sends the responses deflate-encoded.
+     */
+    void setCompressionEnabled(bool enabled);
+    bool isCompressionEnabled() const;
+
+    /**
+     * Makes the next @p count requests of @p method fail, or of any method
+     * when @p method is empty.
+     */
+    void injectError(const QString &method, ErrorType type, int count = 1);
+    void clearErrors();
+
+    int requestCount(const QString &method = QString()) const;
+    qint64 bytesSent() const;
+    void resetStatistics();
+
+private Q_SLOTS:
+    void onNewConnection();
+
+private:
+    struct Fixtures {
+        int projects;
+        int tasksPerProject;
+        int transactionsPerTask;
+        int users;
+        int descriptionSize;
+    };
+
+    void onReadyRead(QTcpSocket *socket);
+    void handleRequest(QTcpSocket *socket, const QByteArray &path, const QByteArray &body);
+    void sendResponse(QTcpSocket *socket, int status, const QByteArray &json);
+
+    QByteArray dispatch(const QString &method, const QJsonObject &params) const;
+    QByteArray queryTasks(const QJsonObject &params) const;
+    QByteArray queryTransactions(const QJsonObject &params) const;
+    QByteArray queryUsers(const QJsonObject &params) const;
+    QByteArray queryProjects(const QJsonObject &params) const;
+
+    int taskIndex(const QByteArray &phid) const;
+    uint taskModified(int index) const;
+    int taskProject(int index) const;
+    void writeTask(QByteArray &out, int index) const;
+    void writeTransactions(QByteArray &out, int index) const;
+    void writeUser(QByteArray &out, int index) const;
+    void writeProject(QByteArray &out, int index) const;
+
+    QTcpServer *mServer;
+    QHash<QTcpSocket *, QByteArray> mBuffers;
+    QString mAPIToken;
+    Fixtures mFixtures;
+    QHash<int, uint> mModified;
+    QHash<int, int> mProjects;
+    int mLatency;
+    bool mCompression;
+    QHash<QString, QPair<ErrorType, int>> mErrors;
+    QHash<QString, int> mRequests;
+    qint64 mBytesSent;
+};
+
+#endif // FAKECONDUITSERVER_H
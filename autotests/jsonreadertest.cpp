@@ -0,0 +1,481 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "../src/liphrary/jsonreader_p.h"
+#include "../src/liphrary/utils_p.h"
+#include "../src/liphrary/maniphest.h"
+#include "../src/liphrary/user.h"
+#include "../src/liphrary/project.h"
+
+#include <QObject>
+#include <QTest>
+#include <QJsonDocument>
+#include <QVariantMap>
+#include <QDateTime>
+#include <QUrl>
+
+#include <limits>
+
+using namespace Phrary;
+using namespace Phrary::Maniphest;
+
+class JsonReaderTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void readerTest();
+    void phidInterningTest();
+    void escapesTest();
+    void invalidInputTest_data();
+    void invalidInputTest();
+
+    void taskResponseTest();
+    void taskPriorityTest_data();
+    void taskPriorityTest();
+    void taskStatusTest();
+    void transactionResponseTest();
+    void userResponseTest();
+    void projectResponseTest();
+    void errorResponseTest();
+    void incrementalDecodingTest_data();
+    void incrementalDecodingTest();
+    void incrementalErrorTest();
+    void arenaDecodingTest();
+
+    void benchmarkJsonReader();
+    void benchmarkQJsonDocument();
+
+private:
+    static QByteArray generateTransactions(int tasks, int transactionsPerTask);
+};
+
+void JsonReaderTest::readerTest()
+{
+    JsonReader reader(QByteArrayLiteral(
+        "{ \"str\": \"foo\", \"num\": 42, \"numstr\": \"43\", \"bool\": true,"
+        "  \"null\": null, \"list\": [\"a\", \"b\"], \"empty\": [],"
+        "  \"nested\": {\"a\": [1, {\"b\": [2, 3]}], \"c\": \"}\"} }"));
+
+    QVERIFY(reader.enterObject());
+    QByteArray key;
+    QVERIFY(reader.nextKey(key));
+    QCOMPARE(key, QByteArray("str"));
+    QCOMPARE(reader.readString(), QStringLiteral("foo"));
+    QVERIFY(reader.nextKey(key));
+    QCOMPARE(key, QByteArray("num"));
+    QCOMPARE(reader.readInt(), 42);
+    QVERIFY(reader.nextKey(key));
+    QCOMPARE(reader.readInt(), 43);
+    QVERIFY(reader.nextKey(key));
+    QCOMPARE(reader.readBool(), true);
+    QVERIFY(reader.nextKey(key));
+    QCOMPARE(reader.peekType(), JsonReader::NullValue);
+    QCOMPARE(reader.readString(), QString());
+    QVERIFY(reader.nextKey(key));
+    QCOMPARE(reader.readStringList(), QStringList() << QStringLiteral("a") << QStringLiteral("b"));
+    QVERIFY(reader.nextKey(key));
+    QCOMPARE(key, QByteArray("empty"));
+    // PHP encodes empty maps as []
+    QVERIFY(reader.enterObject());
+    QVERIFY(!reader.nextKey(key));
+    QVERIFY(reader.nextKey(key));
+    QCOMPARE(key, QByteArray("nested"));
+    reader.skipValue();
+    QVERIFY(!reader.nextKey(key));
+    QVERIFY(reader.atEnd());
+    QVERIFY(!reader.hasError());
+}
+
+void JsonReaderTest::phidInterningTest()
+{
+    const PhidRef a(QByteArrayLiteral("PHID-USER-interningtest"));
+    const PhidRef b(QByteArray("PHID-USER-") + QByteArray("interningtest"));
+    QCOMPARE(a, b);
+    QCOMPARE(a.constData(), b.constData());
+    QCOMPARE(a.toByteArray(), QByteArray("PHID-USER-interningtest"));
+    QCOMPARE(qHash(a), qHash(b));
+    QVERIFY(a != PhidRef(QByteArrayLiteral("PHID-USER-other")));
+
+    const int poolSize = PhidRef::poolSize();
+    JsonReader reader(QByteArrayLiteral("[\"PHID-USER-interningtest\", \"PHID-USER-interningtest\", null]"));
+    const QVector<PhidRef> phids = reader.readPhidList();
+    QCOMPARE(phids.size(), 3);
+    QCOMPARE(phids.at(0), a);
+    QCOMPARE(phids.at(1), a);
+    QVERIFY(phids.at(2).isEmpty());
+    QCOMPARE(PhidRef::poolSize(), poolSize);
+
+    QVERIFY(PhidRef().isEmpty());
+    QVERIFY(PhidRef(QByteArray()).isEmpty());
+    QCOMPARE(PhidRef().toByteArray(), QByteArray());
+}
+
+void JsonReaderTest::escapesTest()
+{
+    JsonReader reader(QByteArrayLiteral(
+        "[\"a\\\"b\\\\c\\/d\\n\", \"\\u00e9\\u20ac\", \"\\ud83d\\ude00\", \"\xc5\xa1\"]"));
+    QCOMPARE(reader.readStringList(),
+             QStringList() << QStringLiteral("a\"b\\c/d\n")
+                           << QString::fromUtf8("\xc3\xa9\xe2\x82\xac")
+                           << QString::fromUtf8("\xf0\x9f\x98\x80")
+                           << QString::fromUtf8("\xc5\xa1"));
+    QVERIFY(!reader.hasError());
+}
+
+void JsonReaderTest::invalidInputTest_data()
+{
+    QTest::addColumn<QByteArray>("data");
+
+    QTest::newRow("empty") << QByteArray();
+    QTest::newRow("truncated object") << QByteArrayLiteral("{\"result\": {\"a\": [1, 2");
+    QTest::newRow("truncated string") << QByteArrayLiteral("{\"result\": \"abc");
+    QTest::newRow("html") << QByteArrayLiteral("<html><body>502 Bad Gateway</body></html>");
+}
+
+void JsonReaderTest::invalidInputTest()
+{
+    QFETCH(QByteArray, data);
+
+    User::List users;
+    int errorCode = 0;
+    QString errorInfo;
+    QVERIFY(!decodeResponse<User>(data, users, errorCode, errorInfo));
+    QVERIFY(errorCode != 0);
+    QVERIFY(!errorInfo.isEmpty());
+}
+
+void JsonReaderTest::taskResponseTest()
+{
+    const QByteArray data = QByteArrayLiteral(
+        "{\"result\":{\"PHID-TASK-1\":{\"id\":\"1\",\"phid\":\"PHID-TASK-1\","
+        "\"authorPHID\":\"PHID-USER-1\",\"ownerPHID\":null,\"ccPHIDs\":[\"PHID-USER-1\",\"PHID-USER-2\"],"
+        "\"status\":\"open\",\"statusName\":\"Open\",\"isClosed\":false,\"priority\":\"High\","
+        "\"priorityColor\":\"red\",\"title\":\"Crash on \\\"sync\\\"\",\"description\":\"**Steps**\","
+        "\"projectPHIDs\":[\"PHID-PROJ-1\"],\"uri\":\"https://phab.example/T1\",\"auxiliary\":[],"
+        "\"objectName\":\"T1\",\"dateCreated\":\"1442000000\",\"dateModified\":\"1442000100\","
+        "\"dependsOnTaskPHIDs\":[]}},\"error_code\":null,\"error_info\":null}");
+
+    Task::List tasks;
+    int errorCode = 0;
+    QString errorInfo;
+    QVERIFY(decodeResponse<Task>(data, tasks, errorCode, errorInfo));
+    QCOMPARE(tasks.size(), 1);
+    const Task &task = tasks.at(0);
+    QCOMPARE(task.phid(), QByteArray("PHID-TASK-1"));
+    QCOMPARE(task.id(), 1u);
+    QCOMPARE(task.authorPHID().toByteArray(), QByteArray("PHID-USER-1"));
+    // Interned, so all references to the same user share the same PHID
+    QCOMPARE(task.ccPHIDs().at(0), task.authorPHID());
+    QCOMPARE(task.ccPHIDs().at(0).constData(), task.authorPHID().constData());
+    QVERIFY(task.ownerPHID().isEmpty());
+    QCOMPARE(task.ccPHIDs().size(), 2);
+    QCOMPARE(task.isClosed(), false);
+    QCOMPARE(task.status(), OpenStatus);
+    QCOMPARE(task.statusName(), QStringLiteral("Open"));
+    QCOMPARE(task.priority(), HighPriority);
+    QCOMPARE(task.priorityName(), QStringLiteral("High"));
+    QCOMPARE(iCalPriority(task.priority()), 7);
+    QCOMPARE(task.title(), QStringLiteral("Crash on \"sync\""));
+    QCOMPARE(task.projectPHIDs(), QVector<PhidRef>() << PhidRef(QByteArrayLiteral("PHID-PROJ-1")));
+    QCOMPARE(task.uri(), QUrl(QStringLiteral("https://phab.example/T1")));
+    QCOMPARE(task.dateCreated(), QDateTime::fromTime_t(1442000000));
+    QCOMPARE(task.dateModified(), QDateTime::fromTime_t(1442000100));
+    QVERIFY(task.dependsOnTaskPHIDs().isEmpty());
+}
+
+void JsonReaderTest::taskPriorityTest_data()
+{
+    QTest::addColumn<QByteArray>("priority");
+    QTest::addColumn<QByteArray>("color");
+    QTest::addColumn<int>("expected");
+
+    QTest::newRow("name") << QByteArray("\"Unbreak Now!\"") << QByteArray("pink") << static_cast<int>(UnbreakNowPriority);
+    QTest::newRow("numeric") << QByteArray("25") << QByteArray("yellow") << static_cast<int>(LowPriority);
+    QTest::newRow("numeric string") << QByteArray("\"90\"") << QByteArray("violet") << static_cast<int>(NeedsTriagePriority);
+    QTest::newRow("renamed") << QByteArray("\"Meh\"") << QByteArray("sky") << static_cast<int>(WishlistPriority);
+    QTest::newRow("custom") << QByteArray("\"Meh\"") << QByteArray("green") << static_cast<int>(UnknownPriority);
+}
+
+void JsonReaderTest::taskPriorityTest()
+{
+    QFETCH(QByteArray, priority);
+    QFETCH(QByteArray, color);
+    QFETCH(int, expected);
+
+    const QByteArray data = "{\"result\":{\"PHID-TASK-1\":{\"status\":\"spite\",\"priority\":" + priority
+                            + ",\"priorityColor\":\"" + color + "\"}},\"error_code\":null,\"error_info\":null}";
+    Task::List tasks;
+    int errorCode = 0;
+    QString errorInfo;
+    QVERIFY(decodeResponse<Task>(data, tasks, errorCode, errorInfo));
+    QCOMPARE(tasks.size(), 1);
+    QCOMPARE(static_cast<int>(tasks.at(0).priority()), expected);
+    QCOMPARE(tasks.at(0).status(), SpiteStatus);
+}
+
+void JsonReaderTest::taskStatusTest()
+{
+    const QByteArray data = "{\"result\":{"
+        "\"PHID-TASK-1\":{\"status\":\"resolved\",\"statusName\":\"Done\"},"
+        "\"PHID-TASK-2\":{\"status\":\"stalled\",\"statusName\":\"Stalled\",\"isClosed\":false},"
+        "\"PHID-TASK-3\":{\"statusName\":\"Stalled\",\"status\":\"open\"}"
+        "},\"error_code\":null,\"error_info\":null}";
+    Task::List tasks;
+    int errorCode = 0;
+    QString errorInfo;
+    QVERIFY(decodeResponse<Task>(data, tasks, errorCode, errorInfo));
+    QCOMPARE(tasks.size(), 3);
+    QCOMPARE(tasks.at(0).status(), ResolvedStatus);
+    QCOMPARE(tasks.at(0).statusName(), QStringLiteral("Resolved"));
+    QCOMPARE(tasks.at(1).status(), UnknownStatus);
+    QCOMPARE(tasks.at(1).statusName(), QStringLiteral("Stalled"));
+    QCOMPARE(tasks.at(2).status(), OpenStatus);
+    QCOMPARE(tasks.at(2).statusName(), QStringLiteral("Open"));
+}
+
+void JsonReaderTest::transactionResponseTest()
+{
+    const QByteArray data = generateTransactions(3, 4);
+
+    Transaction::List trxs;
+    int errorCode = 0;
+    QString errorInfo;
+    QVERIFY(decodeResponse<Transaction>(data, trxs, errorCode, errorInfo));
+    QCOMPARE(trxs.size(), 12);
+    QCOMPARE(trxs.at(0).taskId(), 1);
+    QCOMPARE(trxs.at(11).taskId(), 3);
+    QCOMPARE(trxs.at(5).transactionType(), QByteArray("core:comment"));
+    QVERIFY(!trxs.at(5).comments().isEmpty());
+}
+
+void JsonReaderTest::userResponseTest()
+{
+    const QByteArray data = QByteArrayLiteral(
+        "{\"result\":[{\"phid\":\"PHID-USER-1\",\"userName\":\"jdoe\",\"realName\":\"J. Doe\","
+        "\"image\":\"https://phab.example/file/1.png\",\"uri\":\"https://phab.example/p/jdoe/\","
+        "\"roles\":[\"verified\",\"approved\",\"activated\"]}],\"error_code\":null,\"error_info\":null}");
+
+    User::List users;
+    int errorCode = 0;
+    QString errorInfo;
+    QVERIFY(decodeResponse<User>(data, users, errorCode, errorInfo));
+    QCOMPARE(users.size(), 1);
+    QCOMPARE(users.at(0).phid().toByteArray(), QByteArray("PHID-USER-1"));
+    QCOMPARE(users.at(0).userName(), QStringLiteral("jdoe"));
+    QCOMPARE(users.at(0).realName(), QStringLiteral("J. Doe"));
+    QCOMPARE(users.at(0).roles().size(), 3);
+}
+
+void JsonReaderTest::projectResponseTest()
+{
+    const QByteArray data = QByteArrayLiteral(
+        "{\"result\":{\"data\":{\"PHID-PROJ-1\":{\"id\":\"7\",\"phid\":\"PHID-PROJ-1\",\"name\":\"KDE PIM\","
+        "\"profileImagePHID\":\"PHID-FILE-1\",\"icon\":\"project\",\"color\":\"blue\","
+        "\"members\":[\"PHID-USER-1\"],\"slugs\":[\"kde_pim\"],\"dateCreated\":\"1442000000\","
+        "\"dateModified\":\"1442000000\"}},\"slugMap\":[],\"cursor\":{\"limit\":100,\"after\":null}},"
+        "\"error_code\":null,\"error_info\":null}");
+
+    Project::List projects;
+    int errorCode = 0;
+    QString errorInfo;
+    QVERIFY(decodeResponse<Project>(data, projects, errorCode, errorInfo));
+    QCOMPARE(projects.size(), 1);
+    QCOMPARE(projects.at(0).id(), 7u);
+    QCOMPARE(projects.at(0).name(), QStringLiteral("KDE PIM"));
+    QCOMPARE(projects.at(0).memberPHIDs(), QVector<PhidRef>() << PhidRef(QByteArrayLiteral("PHID-USER-1")));
+    QCOMPARE(projects.at(0).slugs(), QStringList() << QStringLiteral("kde_pim"));
+}
+
+void JsonReaderTest::errorResponseTest()
+{
+    const QByteArray data = QByteArrayLiteral(
+        "{\"result\":null,\"error_code\":\"ERR-INVALID-AUTH\",\"error_info\":\"API token is invalid.\"}");
+
+    Task::List tasks;
+    int errorCode = 0;
+    QString errorInfo;
+    QVERIFY(!decodeResponse<Task>(data, tasks, errorCode, errorInfo));
+    QCOMPARE(errorCode, 1);
+    QCOMPARE(errorInfo, QStringLiteral("API token is invalid."));
+}
+
+void JsonReaderTest::incrementalDecodingTest_data()
+{
+    QTest::addColumn<int>("chunkSize");
+
+    QTest::newRow("1 byte") << 1;
+    QTest::newRow("7 bytes") << 7;
+    QTest::newRow("4 KiB") << 4096;
+    QTest::newRow("whole response") << std::numeric_limits<int>::max();
+}
+
+void JsonReaderTest::incrementalDecodingTest()
+{
+    QFETCH(int, chunkSize);
+
+    const QByteArray data = generateTransactions(20, 3);
+
+    QVector<int> emittedTasks;
+    ResponseDecoder<Transaction> decoder(false, [&emittedTasks](const Transaction::List &trxs) {
+        QCOMPARE(trxs.size(), 3);
+        emittedTasks.push_back(trxs.at(0).taskId());
+    });
+    int emittedHalfway = -1;
+    for (int i = 0; i < data.size(); i += chunkSize) {
+        decoder.append(data.mid(i, chunkSize));
+        const qint64 received = qint64(i) + chunkSize;
+        if (emittedHalfway < 0 && received >= data.size() / 2 && received < data.size()) {
+            emittedHalfway = emittedTasks.size();
+        }
+    }
+    // The transactions of each task are reported as soon as they are
+    // complete, not when the response ends
+    if (emittedHalfway > -1) {
+        QVERIFY(emittedHalfway > 0);
+        QVERIFY(emittedHalfway < 20);
+    }
+
+    Transaction::List trxs;
+    int errorCode = 0;
+    QString errorInfo;
+    QVERIFY(decoder.finish(trxs, errorCode, errorInfo));
+    QCOMPARE(trxs.size(), 60);
+    QCOMPARE(emittedTasks.size(), 20);
+    QCOMPARE(emittedTasks.first(), 1);
+    QCOMPARE(emittedTasks.last(), 20);
+
+    Transaction::List expected;
+    QVERIFY(decodeResponse<Transaction>(data, expected, errorCode, errorInfo));
+    QCOMPARE(trxs.size(), expected.size());
+    for (int i = 0; i < trxs.size(); ++i) {
+        QCOMPARE(trxs.at(i).transactionPHID(), expected.at(i).transactionPHID());
+        QCOMPARE(trxs.at(i).comments(), expected.at(i).comments());
+    }
+}
+
+void JsonReaderTest::incrementalErrorTest()
+{
+    const QByteArray error = QByteArrayLiteral(
+        "{\"result\":null,\"error_code\":\"ERR-CONDUIT-CORE\",\"error_info\":\"Session key is invalid.\"}");
+    ResponseDecoder<User> errorDecoder;
+    errorDecoder.append(error.left(10));
+    errorDecoder.append(error.mid(10));
+
+    User::List users;
+    int errorCode = 0;
+    QString errorInfo;
+    QVERIFY(!errorDecoder.finish(users, errorCode, errorInfo));
+    QCOMPARE(errorInfo, QStringLiteral("Session key is invalid."));
+
+    // Truncated in the middle of the result
+    const QByteArray data = generateTransactions(2, 2);
+    ResponseDecoder<Transaction> truncatedDecoder;
+    truncatedDecoder.append(data.left(data.size() / 2));
+    Transaction::List trxs;
+    QVERIFY(!truncatedDecoder.finish(trxs, errorCode, errorInfo));
+    QVERIFY(errorCode != 0);
+}
+
+void JsonReaderTest::arenaDecodingTest()
+{
+    const QByteArray data = generateTransactions(50, 10);
+
+    Transaction survivor;
+    {
+        Transaction::List trxs;
+        int errorCode = 0;
+        QString errorInfo;
+        {
+            ResponseDecoder<Transaction> decoder(true);
+            decoder.append(data);
+            QVERIFY(decoder.finish(trxs, errorCode, errorInfo));
+        }
+        QCOMPARE(trxs.size(), 500);
+
+        // Outlives both the decoder and the list, and keeps the arena alive
+        survivor = trxs.at(123);
+        // Detaches to a heap-allocated copy
+        trxs[124].setComments(QStringLiteral("Modified"));
+        QCOMPARE(trxs.at(124).comments(), QStringLiteral("Modified"));
+    }
+
+    QCOMPARE(survivor.taskId(), 13);
+    QCOMPARE(survivor.transactionPHID(), QByteArray("PHID-XACT-TASK-13003"));
+    QVERIFY(survivor.comments().startsWith(QLatin1String("Lorem ipsum")));
+}
+
+QByteArray JsonReaderTest::generateTransactions(int tasks, int transactionsPerTask)
+{
+    QByteArray data = "{\"result\":{";
+    for (int task = 1; task <= tasks; ++task) {
+        if (task > 1) {
+            data += ',';
+        }
+        data += '"' + QByteArray::number(task) + "\":[";
+        for (int trx = 0; trx < transactionsPerTask; ++trx) {
+            if (trx > 0) {
+                data += ',';
+            }
+            data += "{\"taskID\":\"" + QByteArray::number(task) + "\","
+                    "\"transactionID\":\"" + QByteArray::number(task * 1000 + trx) + "\","
+                    "\"transactionPHID\":\"PHID-XACT-TASK-" + QByteArray::number(task * 1000 + trx) + "\","
+                    "\"transactionType\":\"core:comment\",\"oldValue\":null,\"newValue\":null,"
+                    "\"comments\":\"Lorem ipsum dolor sit amet, consectetur adipiscing elit, "
+                    "sed do eiusmod tempor incididunt ut labore et dolore magna aliqua.\\n\\n"
+                    "Ut enim ad minim veniam, quis **nostrud** exercitation.\","
+                    "\"authorPHID\":\"PHID-USER-1\",\"dateCreated\":\"1442000000\"}";
+        }
+        data += ']';
+    }
+    data += "},\"error_code\":null,\"error_info\":null}";
+    return data;
+}
+
+void JsonReaderTest::benchmarkJsonReader()
+{
+    const QByteArray data = generateTransactions(500, 40);
+
+    QBENCHMARK {
+        Transaction::List trxs;
+        int errorCode = 0;
+        QString errorInfo;
+        decodeResponse<Transaction>(data, trxs, errorCode, errorInfo);
+        QCOMPARE(trxs.size(), 20000);
+    }
+}
+
+void JsonReaderTest::benchmarkQJsonDocument()
+{
+    // The former decoding path, only builds the intermediate tree for comparison.
+    // Its peak memory is compared by benchmarks/decoderbenchmark.
+    const QByteArray data = generateTransactions(500, 40);
+
+    QBENCHMARK {
+        const QVariantMap map = QJsonDocument::fromJson(data).toVariant().toMap();
+        const QVariantMap result = map[QStringLiteral("result")].toMap();
+        QCOMPARE(result.size(), 500);
+    }
+}
+
+QTEST_GUILESS_MAIN(JsonReaderTest)
+
+#include "jsonreadertest.moc"
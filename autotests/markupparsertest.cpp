@@ -24,6 +24,9 @@
 #include <QObject>
 #include <QTest>
 #include <QDebug>
+#include <QElapsedTimer>
+
+#include <limits>
 
 class MarkupParserTest : public QObject
 {
@@ -37,6 +40,12 @@ private Q_SLOTS:
 
     void realDataMarkupTest_data();
     void realDataMarkupTest();
+
+    void linearScalingTest_data();
+    void linearScalingTest();
+
+    void benchmarkRender_data();
+    void benchmarkRender();
 };
 
 void MarkupParserTest::initTestCase()
@@ -209,6 +218,82 @@ void MarkupParserTest::realDataMarkupTest()
     QCOMPARE(out, expected);
 }
 
+void MarkupParserTest::linearScalingTest_data()
+{
+    QTest::addColumn<QString>("pattern");
+
+    QTest::newRow("log")           << QStringLiteral("#10 0x00007f9d78f8694d in Akonadi::SessionPrivate::~SessionPrivate (this=0x1e534d0) at /home/milian/src/session.cpp:288\n");
+    QTest::newRow("table")         << QStringLiteral("| **foo** | //bar// | {T12 | baz __qux |\n");
+    QTest::newRow("unclosed links") << QStringLiteral("[[a[[b ");
+    QTest::newRow("brackets")      << QStringLiteral("[[");
+    QTest::newRow("long link")     << QStringLiteral("http://a.b/c?u=");
+    QTest::newRow("references")    << QStringLiteral("{T1{D2{F");
+    QTest::newRow("underline headers") << QStringLiteral("Header\n------\n");
+    QTest::newRow("indented")      << QStringLiteral("  code line\n");
+}
+
+/**
+ * Returns the best time of @p rounds renderings of @p text, the slower ones
+ * were disturbed by something else running on the machine.
+ */
+static qint64 renderTime(const QString &text, int rounds)
+{
+    qint64 best = std::numeric_limits<qint64>::max();
+    for (int i = 0; i < rounds; ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        Phrary::Markup::markupToHTML(text);
+        best = qMin(best, timer.nsecsElapsed());
+    }
+    return best;
+}
+
+void MarkupParserTest::linearScalingTest()
+{
+    QFETCH(QString, pattern);
+
+    // Ten times the input may not take much more than ten times longer. The
+    // 100 KB to 1 MB step is cheap enough for every run, set
+    // LIPHRARY_SCALING_TEST to also render 10 MB.
+    const int maxSize = qEnvironmentVariableIsEmpty("LIPHRARY_SCALING_TEST") ? 1024 * 1024 : 10 * 1024 * 1024;
+    qint64 previous = 0;
+    for (int size = 100 * 1024; size <= maxSize; size *= 10) {
+        const QString text = pattern.repeated(qMax(1, size / pattern.size()));
+        const qint64 elapsed = renderTime(text, size > 1024 * 1024 ? 1 : 3);
+        qDebug() << text.size() << "characters rendered in" << elapsed / 1000 << "us";
+
+        if (previous > 0) {
+            QVERIFY2(elapsed < previous * 30,
+                     qPrintable(QStringLiteral("Rendering %1 characters took %2 us, %3 us for ten times less")
+                                    .arg(text.size()).arg(elapsed / 1000).arg(previous / 1000)));
+        }
+        previous = elapsed;
+    }
+}
+
+void MarkupParserTest::benchmarkRender_data()
+{
+    QTest::addColumn<QString>("pattern");
+
+    QTest::newRow("plain")  << QStringLiteral("Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod "
+                                              "tempor incididunt ut labore et dolore magna aliqua. ");
+    QTest::newRow("light")  << QStringLiteral("Lorem ipsum dolor sit amet, **consectetur** adipiscing elit, see {T123} "
+                                              "and https://example.org/foo for details.\n");
+    QTest::newRow("heavy")  << QStringLiteral("**b** //i// __u__ ~~s~~ ##m## `c` [[http://foo.bar|link]] {D1}\n");
+}
+
+void MarkupParserTest::benchmarkRender()
+{
+    QFETCH(QString, pattern);
+
+    const QString text = pattern.repeated(1024 * 1024 / pattern.size());
+
+    QBENCHMARK {
+        const QString out = Phrary::Markup::markupToHTML(text);
+        QVERIFY(out.size() >= text.size() / 2);
+    }
+}
+
 QTEST_MAIN(MarkupParserTest)
 
 #include "markupparsertest.moc"
\ No newline at end of file
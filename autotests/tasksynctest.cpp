@@ -0,0 +1,206 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "fakeconduitserver.h"
+
+#include "tasksync.h"
+#include "usercache.h"
+
+#include <QObject>
+#include <QTest>
+#include <QSet>
+#include <QDateTime>
+#include <QEventLoop>
+
+using namespace Phrary;
+using namespace Phrary::Maniphest;
+
+static const uint BaseTime = 1420070400;
+static const char APIToken[] = "api-fakeconduitserverapitoken";
+
+class TaskSyncTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+
+    void watermarkTest();
+    void movedTasksTest();
+    void readyTasksTest();
+
+private:
+    template<typename T>
+    KAsync::Future<T> runJob(KAsync::Job<T, Server> job);
+
+    FakeConduitServer mConduit;
+    Server mServer;
+    UserCache mUserCache;
+};
+
+template<typename T>
+KAsync::Future<T> TaskSyncTest::runJob(KAsync::Job<T, Server> job)
+{
+    KAsync::FutureWatcher<T> watcher;
+    QEventLoop loop;
+    connect(&watcher, &KAsync::FutureWatcherBase::futureReady, &loop, &QEventLoop::quit);
+    watcher.setFuture(job.exec(mServer));
+    if (!watcher.future().isFinished()) {
+        loop.exec();
+    }
+    return watcher.future();
+}
+
+void TaskSyncTest::initTestCase()
+{
+    QVERIFY(mConduit.listen());
+    mConduit.setAPIToken(QLatin1String(APIToken));
+}
+
+void TaskSyncTest::init()
+{
+    // Tasks 1 to 30 are in the first project, 31 to 60 in the second one. They
+    // were modified an hour after being created, one minute apart.
+    mConduit.generateFixtures(2, 30, 2, 10, 100);
+    mConduit.resetStatistics();
+    mServer = Server(mConduit.url(), QLatin1String(APIToken));
+}
+
+void TaskSyncTest::watermarkTest()
+{
+    const QString project = mConduit.projectPHIDs().at(0);
+
+    const auto watermark = runJob(TaskSync::fetchWatermark());
+    QCOMPARE(watermark.errorCode(), 0);
+    QCOMPARE(watermark.value(), QDateTime::fromTime_t(BaseTime + 60 * 60 + 3600));
+
+    TaskSync::Options options;
+    options.pageSize = 10;
+    options.headersOnly = true;
+    auto page = runJob(TaskSync::fetchPage(project, 0, options, mServer, &mUserCache));
+    QCOMPARE(page.errorCode(), 0);
+    QCOMPARE(page.value().tasks.size(), 10);
+    QCOMPARE(page.value().tasks.first().id(), 30u);
+
+    // Task 26 changes after we've fetched its page, task 6 right after it,
+    // before we get to its page
+    mConduit.setTaskModified(25, BaseTime + 100000);
+    mConduit.setTaskModified(5, BaseTime + 100001);
+
+    QDateTime lastSeen = QDateTime::fromTime_t(0);
+    for (int offset = 10; TaskSync::hasNextPage(options, page.value().tasks.size()); offset += 10) {
+        page = runJob(TaskSync::fetchPage(project, offset, options, mServer, &mUserCache));
+        QCOMPARE(page.errorCode(), 0);
+        Q_FOREACH (const Task &task, page.value().tasks) {
+            lastSeen = qMax(lastSeen, task.dateModified());
+        }
+    }
+    // The most recent change seen by the sync is newer than the one it missed
+    QCOMPARE(lastSeen, QDateTime::fromTime_t(BaseTime + 100001));
+
+    // The next incremental sync starts at the watermark taken before the
+    // first page and picks up both changes
+    options.incremental = true;
+    options.modifiedSince = watermark.value();
+    page = runJob(TaskSync::fetchPage(project, 0, options, mServer, &mUserCache));
+    QCOMPARE(page.errorCode(), 0);
+    QSet<uint> changed;
+    Q_FOREACH (const Task &task, page.value().tasks) {
+        changed.insert(task.id());
+    }
+    QCOMPARE(changed, QSet<uint>({ 6, 26 }));
+    QCOMPARE(page.value().lastModified, QDateTime::fromTime_t(BaseTime + 100001));
+}
+
+void TaskSyncTest::movedTasksTest()
+{
+    const QStringList projects = mConduit.projectPHIDs();
+    const QStringList tasks = mConduit.taskPHIDs();
+
+    // Task 4 moves to the second project, task 41 just changes there
+    mConduit.setTaskProject(3, 1);
+    mConduit.setTaskModified(3, BaseTime + 100000);
+    mConduit.setTaskModified(40, BaseTime + 100001);
+
+    TaskSync::Options options;
+    options.incremental = true;
+    options.modifiedSince = QDateTime::fromTime_t(BaseTime + 100000);
+    auto page = runJob(TaskSync::fetchPage(projects.at(0), 0, options, mServer, &mUserCache));
+    QCOMPARE(page.errorCode(), 0);
+    QVERIFY(page.value().tasks.isEmpty());
+    QCOMPARE(page.value().otherTasks.toSet(), QSet<QString>({ tasks.at(3), tasks.at(40) }));
+    QCOMPARE(page.value().lastModified, QDateTime::fromTime_t(BaseTime + 100001));
+    // Transactions are only fetched for the tasks of the project
+    QCOMPARE(mConduit.requestCount(QStringLiteral("maniphest.gettasktransactions")), 0);
+
+    page = runJob(TaskSync::fetchPage(projects.at(1), 0, options, mServer, &mUserCache));
+    QCOMPARE(page.errorCode(), 0);
+    QCOMPARE(page.value().tasks.size(), 2);
+    QVERIFY(page.value().otherTasks.isEmpty());
+    QCOMPARE(page.value().transactions.size(), 2);
+
+    // A full sync of the first project doesn't see the task anymore
+    options = TaskSync::Options();
+    options.headersOnly = true;
+    page = runJob(TaskSync::fetchPage(projects.at(0), 0, options, mServer, &mUserCache));
+    QCOMPARE(page.errorCode(), 0);
+    QCOMPARE(page.value().tasks.size(), 29);
+}
+
+void TaskSyncTest::readyTasksTest()
+{
+    const QString project = mConduit.projectPHIDs().at(0);
+    TaskSync::Options options;
+    options.pageSize = 20;
+    options.transactionBatchSize = 5;
+
+    // Nothing is ready before the users are known
+    int reported = 0;
+    const TaskSync::PageHandler countReady = [&reported](const TaskSync::Page &) {
+        ++reported;
+    };
+    UserCache users;
+    auto page = runJob(TaskSync::fetchPage(project, 0, options, mServer, &users, countReady));
+    QCOMPARE(page.errorCode(), 0);
+    QCOMPARE(page.value().tasks.size(), 20);
+    QCOMPARE(reported, 0);
+
+    // Each task is reported once, with its transactions, before the page
+    // is complete
+    QSet<uint> ready;
+    page = runJob(TaskSync::fetchPage(project, 0, options, mServer, &users,
+        [&ready](const TaskSync::Page &readyPage) {
+            QCOMPARE(readyPage.tasks.size(), 1);
+            const uint id = readyPage.tasks.first().id();
+            QVERIFY(!ready.contains(id));
+            QCOMPARE(readyPage.transactions.value(id).size(), 2);
+            ready.insert(id);
+        }));
+    QCOMPARE(page.errorCode(), 0);
+    QCOMPARE(ready.size(), 20);
+    QCOMPARE(page.value().transactions.size(), 20);
+    QCOMPARE(mConduit.requestCount(QStringLiteral("maniphest.gettasktransactions")), 8);
+}
+
+QTEST_GUILESS_MAIN(TaskSyncTest)
+
+#include "tasksynctest.moc"
@@ -0,0 +1,236 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Compares the peak memory needed to decode a large maniphest.gettasktransactions
+ * response with the streaming JsonReader and with the former
+ * QJsonDocument/QVariant path. Each decoder runs in a fresh child process so
+ * that their peak RSS can be compared, the results are written as JSON:
+ *
+ *   decoderbenchmark --tasks 2000 --transactions 40 --output results.json
+ *
+ * A single decoder can be run directly with --decoder qjson|reader.
+ */
+
+#include "liphrary/maniphest.h"
+#include "liphrary/jsonreader_p.h"
+#include "liphrary/utils_p.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QVariantMap>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+#include <cstdio>
+
+using namespace Phrary;
+using namespace Phrary::Maniphest;
+
+namespace {
+
+qint64 peakRss()
+{
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        // Kilobytes on Linux
+        return usage.ru_maxrss;
+    }
+#endif
+    return -1;
+}
+
+QByteArray generateTransactions(int tasks, int transactionsPerTask)
+{
+    QByteArray data = "{\"result\":{";
+    for (int task = 1; task <= tasks; ++task) {
+        if (task > 1) {
+            data += ',';
+        }
+        data += '"' + QByteArray::number(task) + "\":[";
+        for (int trx = 0; trx < transactionsPerTask; ++trx) {
+            if (trx > 0) {
+                data += ',';
+            }
+            data += "{\"taskID\":\"" + QByteArray::number(task) + "\","
+                    "\"transactionID\":\"" + QByteArray::number(task * 1000 + trx) + "\","
+                    "\"transactionPHID\":\"PHID-XACT-TASK-" + QByteArray::number(task * 1000 + trx) + "\","
+                    "\"transactionType\":\"core:comment\",\"oldValue\":null,\"newValue\":null,"
+                    "\"comments\":\"Lorem ipsum dolor sit amet, consectetur adipiscing elit, "
+                    "sed do eiusmod tempor incididunt ut labore et dolore magna aliqua.\\n\\n"
+                    "Ut enim ad minim veniam, quis **nostrud** exercitation.\","
+                    "\"authorPHID\":\"PHID-USER-" + QByteArray::number(trx % 50) + "\","
+                    "\"dateCreated\":\"1442000000\"}";
+        }
+        data += ']';
+    }
+    data += "},\"error_code\":null,\"error_info\":null}";
+    return data;
+}
+
+Transaction::List decodeWithReader(const QByteArray &data)
+{
+    Transaction::List transactions;
+    int errorCode = 0;
+    QString errorInfo;
+    decodeResponse<Transaction>(data, transactions, errorCode, errorInfo);
+    return transactions;
+}
+
+/**
+ * The decoding path used before JsonReader: the whole document is converted
+ * to a QVariant tree, which stays alive while the transactions are built.
+ */
+Transaction::List decodeWithQJsonDocument(const QByteArray &data)
+{
+    Transaction::List transactions;
+    const QVariantMap map = QJsonDocument::fromJson(data).toVariant().toMap();
+    const QVariantMap result = map.value(QStringLiteral("result")).toMap();
+    for (auto it = result.cbegin(), end = result.cend(); it != end; ++it) {
+        Q_FOREACH (const QVariant &value, it->toList()) {
+            const QVariantMap trxMap = value.toMap();
+            Transaction trx;
+            trx.setTaskId(trxMap.value(QStringLiteral("taskID")).toInt());
+            trx.setTransactionPHID(trxMap.value(QStringLiteral("transactionPHID")).toByteArray());
+            trx.setTransactionType(trxMap.value(QStringLiteral("transactionType")).toByteArray());
+            trx.setComments(trxMap.value(QStringLiteral("comments")).toString());
+            trx.setAuthorPHID(PhidRef(trxMap.value(QStringLiteral("authorPHID")).toByteArray()));
+            trx.setDateCreated(QDateTime::fromTime_t(trxMap.value(QStringLiteral("dateCreated")).toUInt()));
+            transactions.push_back(trx);
+        }
+    }
+    return transactions;
+}
+
+/**
+ * Decodes the response with @p decoder and writes the result to stdout.
+ */
+int runDecoder(const QString &decoder, int tasks, int transactionsPerTask)
+{
+    const QByteArray data = generateTransactions(tasks, transactionsPerTask);
+    const qint64 rssBefore = peakRss();
+
+    QElapsedTimer timer;
+    timer.start();
+    Transaction::List transactions;
+    if (decoder == QLatin1String("qjson")) {
+        transactions = decodeWithQJsonDocument(data);
+    } else if (decoder == QLatin1String("reader")) {
+        transactions = decodeWithReader(data);
+    } else {
+        qWarning() << "Unknown decoder" << decoder;
+        return 1;
+    }
+    const qint64 wallTime = timer.nsecsElapsed();
+
+    if (transactions.size() != tasks * transactionsPerTask) {
+        qWarning() << "Decoded" << transactions.size() << "transactions, expected" << tasks * transactionsPerTask;
+        return 1;
+    }
+
+    const qint64 rssAfter = peakRss();
+    QJsonObject result;
+    result.insert(QStringLiteral("decoder"), decoder);
+    result.insert(QStringLiteral("transactions"), transactions.size());
+    result.insert(QStringLiteral("responseBytes"), data.size());
+    result.insert(QStringLiteral("wallMs"), wallTime / 1000000.0);
+    result.insert(QStringLiteral("baselineRssKb"), double(rssBefore));
+    result.insert(QStringLiteral("peakRssKb"), double(rssAfter));
+    result.insert(QStringLiteral("decoderRssKb"), double(rssAfter - rssBefore));
+
+    std::printf("%s\n", QJsonDocument(result).toJson(QJsonDocument::Compact).constData());
+    std::fflush(stdout);
+    return 0;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Compares the peak memory of the Conduit response decoders"));
+    parser.addHelpOption();
+    const QCommandLineOption tasksOption(QStringLiteral("tasks"),
+        QStringLiteral("Number of tasks in the response."), QStringLiteral("count"), QStringLiteral("2000"));
+    const QCommandLineOption transactionsOption(QStringLiteral("transactions"),
+        QStringLiteral("Transactions per task."), QStringLiteral("count"), QStringLiteral("40"));
+    const QCommandLineOption outputOption(QStringLiteral("output"),
+        QStringLiteral("Write the results to <file> instead of stdout."), QStringLiteral("file"));
+    const QCommandLineOption decoderOption(QStringLiteral("decoder"),
+        QStringLiteral("Measure a single decoder, qjson or reader, in this process."), QStringLiteral("decoder"));
+    parser.addOptions({ tasksOption, transactionsOption, outputOption, decoderOption });
+    parser.process(app);
+
+    const int tasks = qMax(1, parser.value(tasksOption).toInt());
+    const int transactionsPerTask = qMax(1, parser.value(transactionsOption).toInt());
+
+    if (parser.isSet(decoderOption)) {
+        return runDecoder(parser.value(decoderOption), tasks, transactionsPerTask);
+    }
+
+    // Every decoder in a process of its own, so that they do not share the peak RSS
+    QJsonArray results;
+    Q_FOREACH (const QString &decoder, QStringList({ QStringLiteral("qjson"), QStringLiteral("reader") })) {
+        QProcess child;
+        child.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        child.start(app.applicationFilePath(),
+                    { QStringLiteral("--tasks"), QString::number(tasks),
+                      QStringLiteral("--transactions"), QString::number(transactionsPerTask),
+                      QStringLiteral("--decoder"), decoder });
+        if (!child.waitForFinished(-1) || child.exitCode() != 0) {
+            qWarning() << "Benchmark of the" << decoder << "decoder failed";
+            return 1;
+        }
+        results.push_back(QJsonDocument::fromJson(child.readAllStandardOutput().trimmed()).object());
+        qWarning() << "Decoder" << decoder << "needed"
+                   << results.last().toObject().value(QStringLiteral("decoderRssKb")).toDouble() << "kB";
+    }
+
+    QJsonObject report;
+    report.insert(QStringLiteral("benchmark"), QStringLiteral("decoder"));
+    report.insert(QStringLiteral("timestamp"), QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    report.insert(QStringLiteral("qtVersion"), QString::fromLatin1(qVersion()));
+    report.insert(QStringLiteral("results"), results);
+
+    const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size()) {
+            qWarning() << "Failed to write" << file.fileName() << ":" << file.errorString();
+            return 1;
+        }
+    } else {
+        std::fwrite(json.constData(), 1, json.size(), stdout);
+    }
+    return 0;
+}
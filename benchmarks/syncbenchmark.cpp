@@ -0,0 +1,606 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * End-to-end benchmark of a sync: tasks, transactions and users are fetched
+ * from a FakeConduitServer, parsed by liphrary and converted to todos the way
+ * the resource does it, for several sizes of the Phabricator instance.
+ *
+ * Each size is measured in a fresh child process, with the server in yet
+ * another process, so that the peak RSS and the allocations belong to the
+ * client alone. The results are written as JSON:
+ *
+ *   syncbenchmark --tasks 1000,10000,100000 --output results.json
+ *
+ * A single size can be run directly with --run, e.g. under a profiler.
+ *
+ * The projects are paged through by TaskSync, exactly like the resource does
+ * it: ordered by creation time until an empty page, with the transactions in
+ * concurrent batches and the missing users once per page. --lazy fetches only
+ * the task headers and --changed measures an incremental sync in addition to
+ * the full one. What remains different from the resource:
+ *
+ *  - The todos are not wrapped in Akonadi items and not sent anywhere, with
+ *    --lazy only the summaries are built.
+ *  - The user cache starts empty, so stale users are never refreshed.
+ *  - The changed tasks are already changed during the full sync, the
+ *    incremental sync just asks for the changes since before they happened.
+ */
+
+#include "fakeconduitserver.h"
+#include "taskconverter.h"
+#include "tasksync.h"
+#include "usercache.h"
+#include "markupcache.h"
+#include "liphrary/server.h"
+#include "liphrary/maniphest.h"
+#include "liphrary/markup.h"
+#include "liphrary/project.h"
+#include "liphrary/user.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QtConcurrentMap>
+
+#include <KAsync/Async>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+std::atomic<quint64> sAllocations{0};
+std::atomic<quint64> sAllocatedBytes{0};
+
+}
+
+#ifdef __GLIBC__
+// Count every heap allocation of the process, including those of Qt and
+// the other libraries, which do not go through operator new
+static const bool AllocationsCounted = true;
+
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) noexcept
+{
+    sAllocations.fetch_add(1, std::memory_order_relaxed);
+    sAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept
+{
+    sAllocations.fetch_add(1, std::memory_order_relaxed);
+    sAllocatedBytes.fetch_add(count * size, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept
+{
+    sAllocations.fetch_add(1, std::memory_order_relaxed);
+    sAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+}
+#else
+static const bool AllocationsCounted = false;
+#endif
+
+namespace {
+
+static const char APIToken[] = "api-syncbenchmark";
+// After the modification time of every generated task
+static const uint ChangedSince = 1735689600; // 2025-01-01
+
+struct Options
+{
+    QVector<int> taskCounts;
+    int projects;
+    int transactionsPerTask;
+    int users;
+    int descriptionSize;
+    int pageSize;
+    int transactionBatchSize;
+    int maxParallelRequests;
+    int latency;
+    bool compression;
+    bool arenaAllocation;
+    bool parallelConversion;
+    bool headersOnly;
+    int changedTasks;
+};
+
+qint64 peakRss()
+{
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        // Kilobytes on Linux
+        return usage.ru_maxrss;
+    }
+#endif
+    return -1;
+}
+
+int tasksPerProject(const Options &options, int tasks)
+{
+    return (tasks + options.projects - 1) / options.projects;
+}
+
+/**
+ * Runs all @p jobs concurrently and waits until all of them finish.
+ */
+template<typename T>
+QVector<KAsync::Future<T>> execAll(const QVector<KAsync::Job<T, Phrary::Server>> &jobs,
+                                   const Phrary::Server &server)
+{
+    QEventLoop loop;
+    std::vector<std::unique_ptr<KAsync::FutureWatcher<T>>> watchers;
+    watchers.reserve(jobs.size());
+    Q_FOREACH (const auto &job, jobs) {
+        watchers.emplace_back(new KAsync::FutureWatcher<T>());
+        QObject::connect(watchers.back().get(), &KAsync::FutureWatcherBase::futureReady,
+                         &loop, &QEventLoop::quit);
+        auto j = job;
+        watchers.back()->setFuture(j.exec(server));
+    }
+
+    const auto allFinished = [&watchers]() {
+        for (const auto &watcher : watchers) {
+            if (!watcher->future().isFinished()) {
+                return false;
+            }
+        }
+        return true;
+    };
+    while (!allFinished()) {
+        loop.exec();
+    }
+
+    QVector<KAsync::Future<T>> futures;
+    futures.reserve(jobs.size());
+    for (const auto &watcher : watchers) {
+        futures.push_back(watcher->future());
+    }
+    return futures;
+}
+
+template<typename T>
+bool checkFutures(const QVector<KAsync::Future<T>> &futures)
+{
+    Q_FOREACH (const auto &future, futures) {
+        if (future.errorCode()) {
+            qWarning() << "Request failed:" << future.errorMessage();
+            return false;
+        }
+    }
+    return true;
+}
+
+class SyncBenchmark
+{
+public:
+    SyncBenchmark(const Options &options, const QString &url)
+        : mOptions(options)
+        , mServer(url, QLatin1String(APIToken))
+        , mItems(0)
+        , mHtmlSize(0)
+        , mConvertTime(0)
+    {
+        mServer.setArenaAllocation(options.arenaAllocation);
+        mServer.scheduler()->setMaxParallelRequests(options.maxParallelRequests);
+        mMarkupCache.setMaxSize(16384);
+        Phrary::Markup::setPhabricatorUrl(url);
+    }
+
+    bool run(const QStringList &projectPHIDs, const TaskSync::Options &syncOptions);
+    QJsonObject result() const;
+    void resetStatistics();
+
+private:
+    bool syncProject(const QString &projectPHID, const TaskSync::Options &syncOptions);
+    void convert(const TaskSync::Page &page, const TaskSync::Options &syncOptions);
+
+    Options mOptions;
+    Phrary::Server mServer;
+    UserCache mUserCache;
+    MarkupCache mMarkupCache;
+    qint64 mItems;
+    qint64 mHtmlSize;
+    qint64 mConvertTime;
+};
+
+bool SyncBenchmark::run(const QStringList &projectPHIDs, const TaskSync::Options &syncOptions)
+{
+    const auto projects = execAll<Phrary::Project::List>({ Phrary::Project::query(projectPHIDs) }, mServer);
+    if (!checkFutures(projects)) {
+        return false;
+    }
+
+    Q_FOREACH (const Phrary::Project &project, projects.first().value()) {
+        if (!syncProject(project.phid().toString(), syncOptions)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SyncBenchmark::syncProject(const QString &projectPHID, const TaskSync::Options &syncOptions)
+{
+    for (int offset = 0;;) {
+        const auto pages = execAll<TaskSync::Page>(
+            { TaskSync::fetchPage(projectPHID, offset, syncOptions, mServer, &mUserCache) }, mServer);
+        if (!checkFutures(pages)) {
+            return false;
+        }
+
+        const TaskSync::Page page = pages.first().value();
+        convert(page, syncOptions);
+
+        if (!TaskSync::hasNextPage(syncOptions, page.tasks.size())) {
+            return true;
+        }
+        offset += page.tasks.size();
+    }
+}
+
+void SyncBenchmark::convert(const TaskSync::Page &page, const TaskSync::Options &syncOptions)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const Phrary::Maniphest::Task::List &tasks = page.tasks;
+    if (syncOptions.headersOnly) {
+        Q_FOREACH (const Phrary::Maniphest::Task &task, tasks) {
+            mHtmlSize += TaskConverter::summary(task).size();
+        }
+        mConvertTime += timer.nsecsElapsed();
+        mItems += tasks.size();
+        return;
+    }
+
+    const std::function<KCalCore::Todo::Ptr(const Phrary::Maniphest::Task &)> toTodo =
+        [this, &page](const Phrary::Maniphest::Task &task) {
+            return TaskConverter::toTodo(task, page.transactions.value(task.id()), mUserCache, mMarkupCache);
+        };
+
+    QVector<KCalCore::Todo::Ptr> todos;
+    if (tasks.size() < 2 || !mOptions.parallelConversion) {
+        todos.reserve(tasks.size());
+        std::transform(tasks.cbegin(), tasks.cend(), std::back_inserter(todos), toTodo);
+    } else {
+        todos = QtConcurrent::blockingMapped<QVector<KCalCore::Todo::Ptr>>(tasks, toTodo);
+    }
+
+    mConvertTime += timer.nsecsElapsed();
+    mItems += todos.size();
+    Q_FOREACH (const KCalCore::Todo::Ptr &todo, todos) {
+        mHtmlSize += todo->description().size();
+    }
+}
+
+void SyncBenchmark::resetStatistics()
+{
+    mServer.resetTransferStatistics();
+    mItems = 0;
+    mHtmlSize = 0;
+    mConvertTime = 0;
+}
+
+QJsonObject SyncBenchmark::result() const
+{
+    qint64 requests = 0;
+    qint64 bytesReceived = 0;
+    qint64 bytesDecoded = 0;
+    QJsonObject requestsByMethod;
+    const auto stats = mServer.transferStatistics();
+    for (auto it = stats.cbegin(), end = stats.cend(); it != end; ++it) {
+        requests += it->requests;
+        bytesReceived += it->bytesReceived;
+        bytesDecoded += it->bytesDecoded;
+        requestsByMethod.insert(it.key(), double(it->requests));
+    }
+
+    QJsonObject result;
+    result.insert(QStringLiteral("items"), double(mItems));
+    result.insert(QStringLiteral("convertMs"), mConvertTime / 1000000.0);
+    result.insert(QStringLiteral("requests"), double(requests));
+    result.insert(QStringLiteral("requestsByMethod"), requestsByMethod);
+    result.insert(QStringLiteral("bytesReceived"), double(bytesReceived));
+    result.insert(QStringLiteral("bytesParsed"), double(bytesDecoded));
+    result.insert(QStringLiteral("htmlChars"), double(mHtmlSize));
+    return result;
+}
+
+QStringList fixtureArguments(const Options &options, int tasks)
+{
+    return {
+        QString::number(options.projects),
+        QString::number(tasksPerProject(options, tasks)),
+        QString::number(options.transactionsPerTask),
+        QString::number(options.users),
+        QString::number(options.descriptionSize)
+    };
+}
+
+/**
+ * Serves the fixtures until killed. The URL is written to stdout once
+ * the server is listening.
+ */
+int serve(const Options &options, int tasks)
+{
+    FakeConduitServer server;
+    server.setAPIToken(QLatin1String(APIToken));
+    server.setLatency(options.latency);
+    server.setCompressionEnabled(options.compression);
+    const QStringList fixture = fixtureArguments(options, tasks);
+    server.generateFixtures(fixture[0].toInt(), fixture[1].toInt(), fixture[2].toInt(),
+                            fixture[3].toInt(), fixture[4].toInt());
+    // Spread over all the projects
+    const int changed = qMin(options.changedTasks, server.taskCount());
+    for (int i = 0; i < changed; ++i) {
+        server.setTaskModified(int(qint64(i) * server.taskCount() / changed), ChangedSince + i + 1);
+    }
+    if (!server.listen()) {
+        qWarning() << "Failed to start the server";
+        return 1;
+    }
+
+    std::printf("%s\n", qPrintable(server.url()));
+    std::fflush(stdout);
+    return QCoreApplication::exec();
+}
+
+/**
+ * Syncs an instance with @p tasks tasks and writes the result to stdout.
+ */
+int runSync(const Options &options, int tasks)
+{
+    QProcess serverProcess;
+    serverProcess.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    QStringList arguments = QCoreApplication::arguments().mid(1);
+    arguments << QStringLiteral("--serve") << QString::number(tasks);
+    serverProcess.start(QCoreApplication::applicationFilePath(), arguments);
+    while (!serverProcess.canReadLine()) {
+        if (!serverProcess.waitForReadyRead(60000)) {
+            qWarning() << "Failed to start the server process:" << serverProcess.errorString();
+            return 1;
+        }
+    }
+    const QString url = QString::fromLatin1(serverProcess.readLine().trimmed());
+
+    // The fixtures are deterministic, this only gives the PHIDs of the
+    // projects that the resource would be configured with
+    FakeConduitServer fixtures;
+    const QStringList fixture = fixtureArguments(options, tasks);
+    fixtures.generateFixtures(fixture[0].toInt(), fixture[1].toInt());
+
+    const qint64 rssBefore = peakRss();
+    const quint64 allocationsBefore = sAllocations.load();
+    const quint64 allocatedBytesBefore = sAllocatedBytes.load();
+    QElapsedTimer timer;
+    timer.start();
+
+    TaskSync::Options syncOptions;
+    syncOptions.pageSize = options.pageSize;
+    syncOptions.transactionBatchSize = options.transactionBatchSize;
+    syncOptions.headersOnly = options.headersOnly;
+
+    bool ok;
+    QJsonObject result;
+    qint64 wallTime;
+    quint64 allocations;
+    quint64 allocatedBytes;
+    qint64 rssAfter;
+    {
+        SyncBenchmark benchmark(options, url);
+        ok = benchmark.run(fixtures.projectPHIDs(), syncOptions);
+        result = benchmark.result();
+
+        wallTime = timer.nsecsElapsed();
+        allocations = sAllocations.load() - allocationsBefore;
+        allocatedBytes = sAllocatedBytes.load() - allocatedBytesBefore;
+        rssAfter = peakRss();
+
+        if (ok && options.changedTasks > 0) {
+            benchmark.resetStatistics();
+            syncOptions.incremental = true;
+            syncOptions.modifiedSince = QDateTime::fromTime_t(ChangedSince);
+            timer.restart();
+            ok = benchmark.run(fixtures.projectPHIDs(), syncOptions);
+            QJsonObject incremental = benchmark.result();
+            incremental.insert(QStringLiteral("wallMs"), timer.nsecsElapsed() / 1000000.0);
+            result.insert(QStringLiteral("incremental"), incremental);
+        }
+    }
+
+    serverProcess.kill();
+    serverProcess.waitForFinished();
+
+    if (!ok) {
+        return 1;
+    }
+
+    result.insert(QStringLiteral("tasks"), fixtures.taskCount());
+    result.insert(QStringLiteral("projects"), options.projects);
+    result.insert(QStringLiteral("wallMs"), wallTime / 1000000.0);
+    result.insert(QStringLiteral("allocations"), AllocationsCounted ? double(allocations) : -1.0);
+    result.insert(QStringLiteral("allocatedBytes"), AllocationsCounted ? double(allocatedBytes) : -1.0);
+    result.insert(QStringLiteral("baselineRssKb"), double(rssBefore));
+    result.insert(QStringLiteral("peakRssKb"), double(rssAfter));
+
+    std::printf("%s\n", QJsonDocument(result).toJson(QJsonDocument::Compact).constData());
+    std::fflush(stdout);
+    return 0;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Measures a complete sync against a fake Phabricator server"));
+    parser.addHelpOption();
+    const QCommandLineOption tasksOption(QStringLiteral("tasks"),
+        QStringLiteral("Comma-separated sizes of the instance, in tasks."), QStringLiteral("counts"),
+        QStringLiteral("1000,10000,100000"));
+    const QCommandLineOption projectsOption(QStringLiteral("projects"),
+        QStringLiteral("Number of projects the tasks are spread over."), QStringLiteral("count"),
+        QStringLiteral("10"));
+    const QCommandLineOption transactionsOption(QStringLiteral("transactions"),
+        QStringLiteral("Transactions per task, half of them comments."), QStringLiteral("count"),
+        QStringLiteral("4"));
+    const QCommandLineOption usersOption(QStringLiteral("users"),
+        QStringLiteral("Number of distinct users."), QStringLiteral("count"), QStringLiteral("200"));
+    const QCommandLineOption descriptionOption(QStringLiteral("description-size"),
+        QStringLiteral("Approximate size of task descriptions."), QStringLiteral("chars"), QStringLiteral("400"));
+    const QCommandLineOption pageSizeOption(QStringLiteral("page-size"),
+        QStringLiteral("Tasks requested per page."), QStringLiteral("count"), QStringLiteral("100"));
+    const QCommandLineOption batchOption(QStringLiteral("transaction-batch-size"),
+        QStringLiteral("Tasks per transactions request."), QStringLiteral("count"), QStringLiteral("50"));
+    const QCommandLineOption parallelOption(QStringLiteral("parallel-requests"),
+        QStringLiteral("Maximum number of requests in parallel."), QStringLiteral("count"), QStringLiteral("4"));
+    const QCommandLineOption latencyOption(QStringLiteral("latency"),
+        QStringLiteral("Latency added by the server to each response."), QStringLiteral("msecs"), QStringLiteral("0"));
+    const QCommandLineOption compressionOption(QStringLiteral("compression"),
+        QStringLiteral("Send compressed responses."));
+    const QCommandLineOption noArenaOption(QStringLiteral("no-arena"),
+        QStringLiteral("Do not allocate tasks and transactions from arenas."));
+    const QCommandLineOption serialOption(QStringLiteral("serial"),
+        QStringLiteral("Convert tasks on a single thread."));
+    const QCommandLineOption lazyOption(QStringLiteral("lazy"),
+        QStringLiteral("Fetch only the task headers, like with lazy task payloads."));
+    const QCommandLineOption changedOption(QStringLiteral("changed"),
+        QStringLiteral("Also measure an incremental sync that finds <count> changed tasks."), QStringLiteral("count"),
+        QStringLiteral("0"));
+    const QCommandLineOption outputOption(QStringLiteral("output"),
+        QStringLiteral("Write the results to <file> instead of stdout."), QStringLiteral("file"));
+    const QCommandLineOption runOption(QStringLiteral("run"),
+        QStringLiteral("Measure a single size in this process."), QStringLiteral("tasks"));
+    QCommandLineOption serveOption(QStringLiteral("serve"), QString(), QStringLiteral("tasks"));
+    serveOption.setHidden(true);
+    parser.addOptions({ tasksOption, projectsOption, transactionsOption, usersOption, descriptionOption,
+                        pageSizeOption, batchOption, parallelOption, latencyOption, compressionOption,
+                        noArenaOption, serialOption, lazyOption, changedOption, outputOption, runOption, serveOption });
+    parser.process(app);
+
+    Options options;
+    Q_FOREACH (const QString &count, parser.value(tasksOption).split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        options.taskCounts.push_back(qMax(1, count.toInt()));
+    }
+    options.projects = qMax(1, parser.value(projectsOption).toInt());
+    options.transactionsPerTask = qMax(0, parser.value(transactionsOption).toInt());
+    options.users = qMax(1, parser.value(usersOption).toInt());
+    options.descriptionSize = qMax(0, parser.value(descriptionOption).toInt());
+    options.pageSize = qMax(1, parser.value(pageSizeOption).toInt());
+    options.transactionBatchSize = qMax(1, parser.value(batchOption).toInt());
+    options.maxParallelRequests = qMax(1, parser.value(parallelOption).toInt());
+    options.latency = qMax(0, parser.value(latencyOption).toInt());
+    options.compression = parser.isSet(compressionOption);
+    options.arenaAllocation = !parser.isSet(noArenaOption);
+    options.parallelConversion = !parser.isSet(serialOption);
+    options.headersOnly = parser.isSet(lazyOption);
+    options.changedTasks = qMax(0, parser.value(changedOption).toInt());
+
+    if (parser.isSet(serveOption)) {
+        return serve(options, parser.value(serveOption).toInt());
+    }
+    if (parser.isSet(runOption)) {
+        return runSync(options, parser.value(runOption).toInt());
+    }
+
+    // Every size in a process of its own, so that they do not share the peak RSS
+    QJsonArray results;
+    Q_FOREACH (int tasks, options.taskCounts) {
+        QProcess child;
+        child.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        QStringList arguments = app.arguments().mid(1);
+        arguments << QStringLiteral("--run") << QString::number(tasks);
+        child.start(app.applicationFilePath(), arguments);
+        if (!child.waitForFinished(-1) || child.exitCode() != 0) {
+            qWarning() << "Benchmark of" << tasks << "tasks failed";
+            return 1;
+        }
+        const QByteArray output = child.readAllStandardOutput();
+        results.push_back(QJsonDocument::fromJson(output.trimmed()).object());
+        qWarning() << "Synced" << tasks << "tasks in" << results.last().toObject().value(QStringLiteral("wallMs")).toDouble() << "ms";
+    }
+
+    QJsonObject configuration;
+    configuration.insert(QStringLiteral("projects"), options.projects);
+    configuration.insert(QStringLiteral("transactionsPerTask"), options.transactionsPerTask);
+    configuration.insert(QStringLiteral("users"), options.users);
+    configuration.insert(QStringLiteral("descriptionSize"), options.descriptionSize);
+    configuration.insert(QStringLiteral("pageSize"), options.pageSize);
+    configuration.insert(QStringLiteral("transactionBatchSize"), options.transactionBatchSize);
+    configuration.insert(QStringLiteral("parallelRequests"), options.maxParallelRequests);
+    configuration.insert(QStringLiteral("latencyMs"), options.latency);
+    configuration.insert(QStringLiteral("compression"), options.compression);
+    configuration.insert(QStringLiteral("arenaAllocation"), options.arenaAllocation);
+    configuration.insert(QStringLiteral("parallelConversion"), options.parallelConversion);
+    configuration.insert(QStringLiteral("headersOnly"), options.headersOnly);
+    configuration.insert(QStringLiteral("changedTasks"), options.changedTasks);
+
+    QJsonObject report;
+    report.insert(QStringLiteral("benchmark"), QStringLiteral("sync"));
+    report.insert(QStringLiteral("timestamp"), QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    report.insert(QStringLiteral("qtVersion"), QString::fromLatin1(qVersion()));
+    report.insert(QStringLiteral("configuration"), configuration);
+    report.insert(QStringLiteral("results"), results);
+
+    const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size()) {
+            qWarning() << "Failed to write" << file.fileName() << ":" << file.errorString();
+            return 1;
+        }
+    } else {
+        std::fwrite(json.constData(), 1, json.size(), stdout);
+    }
+    return 0;
+}
@@ -130,9 +130,9 @@ void ConfigDialog::loadProjects()
                 for (const auto &project : projects) {
                     QListWidgetItem *item = new QListWidgetItem();
                     item->setText(project.name());
-                    item->setData(Qt::UserRole, project.phid());
+                    item->setData(Qt::UserRole, project.phid().toByteArray());
                     item->setFlags(Qt::ItemIsEnabled | Qt::ItemIsUserCheckable);
-                    item->setCheckState(Settings::self()->projects().contains(QString::fromUtf8(project.phid())) ? Qt::Checked : Qt::Unchecked);
+                    item->setCheckState(Settings::self()->projects().contains(project.phid().toString()) ? Qt::Checked : Qt::Unchecked);
                     ui->maniphestProjectsView->addItem(item);
                 }
             })
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "arena_p.h"
+
+#include <new>
+
+using namespace Phrary;
+
+static const std::size_t BlockSize = 64 * 1024;
+
+/**
+ * Every allocation is prefixed with a pointer to the arena it was allocated
+ * from, or null for heap allocations, padded to keep the object aligned.
+ */
+static const std::size_t HeaderSize = alignof(std::max_align_t) > sizeof(Arena*)
+                                      ? alignof(std::max_align_t) : sizeof(Arena*);
+
+static thread_local Arena *sCurrentArena = Q_NULLPTR;
+
+Arena::Arena()
+    : mRef(1)
+    , mPos(Q_NULLPTR)
+    , mFree(0)
+{
+}
+
+Arena::~Arena()
+{
+    for (char *block : mBlocks) {
+        ::operator delete(block);
+    }
+}
+
+Arena *Arena::create()
+{
+    return new Arena;
+}
+
+void Arena::ref()
+{
+    mRef.ref();
+}
+
+void Arena::deref()
+{
+    if (!mRef.deref()) {
+        delete this;
+    }
+}
+
+char *Arena::allocateFromBlock(std::size_t size)
+{
+    // Large objects would waste too much of a block
+    if (size > BlockSize / 4) {
+        return Q_NULLPTR;
+    }
+
+    if (size > mFree) {
+        mPos = static_cast<char*>(::operator new(BlockSize));
+        mFree = BlockSize;
+        mBlocks.push_back(mPos);
+    }
+
+    char *ptr = mPos;
+    mPos += size;
+    mFree -= size;
+    return ptr;
+}
+
+void *Arena::allocate(std::size_t size)
+{
+    // Round up, so that the next allocation from the block is aligned too
+    const std::size_t total = (HeaderSize + size + HeaderSize - 1) & ~(HeaderSize - 1);
+
+    Arena *arena = sCurrentArena;
+    char *ptr = arena ? arena->allocateFromBlock(total) : Q_NULLPTR;
+    if (ptr) {
+        arena->ref();
+    } else {
+        ptr = static_cast<char*>(::operator new(total));
+        arena = Q_NULLPTR;
+    }
+
+    *reinterpret_cast<Arena**>(ptr) = arena;
+    return ptr + HeaderSize;
+}
+
+void Arena::deallocate(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+
+    char *block = static_cast<char*>(ptr) - HeaderSize;
+    Arena *arena = *reinterpret_cast<Arena**>(block);
+    if (arena) {
+        arena->deref();
+    } else {
+        ::operator delete(block);
+    }
+}
+
+Arena::Scope::Scope(Arena *arena)
+    : mPrevious(sCurrentArena)
+{
+    sCurrentArena = arena;
+}
+
+Arena::Scope::~Scope()
+{
+    sCurrentArena = mPrevious;
+}
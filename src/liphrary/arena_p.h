@@ -0,0 +1,90 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PHRARY_ARENA_P_H
+#define PHRARY_ARENA_P_H
+
+#include <QAtomicInt>
+#include <QVector>
+
+#include <cstddef>
+
+namespace Phrary
+{
+
+/**
+ * Memory region for the many small objects decoded from a single response.
+ *
+ * Classes opt in by forwarding their operator new and operator delete to
+ * Arena::allocate() and Arena::deallocate(). While an Arena::Scope is active
+ * in the current thread, new objects are carved out of large blocks of the
+ * scope's arena instead of being allocated one by one. Outside of a scope
+ * (for instance when a QSharedDataPointer detaches later on) they are
+ * allocated on the heap as usual.
+ *
+ * Every allocation records where it came from, so objects from an arena
+ * and from the heap can be mixed freely. An arena is reference counted by
+ * the objects living in it and freed with the last of them, which may
+ * happen in any thread.
+ */
+class Arena
+{
+public:
+    static Arena *create();
+
+    void ref();
+    void deref();
+
+    static void *allocate(std::size_t size);
+    static void deallocate(void *ptr);
+
+    /**
+     * Makes @p arena the current arena of this thread until the scope is
+     * destroyed. @p arena can be null to allocate from the heap.
+     */
+    class Scope
+    {
+    public:
+        explicit Scope(Arena *arena);
+        ~Scope();
+
+    private:
+        Q_DISABLE_COPY(Scope)
+
+        Arena *mPrevious;
+    };
+
+private:
+    Arena();
+    ~Arena();
+    Q_DISABLE_COPY(Arena)
+
+    char *allocateFromBlock(std::size_t size);
+
+    QAtomicInt mRef;
+    QVector<char*> mBlocks;
+    char *mPos;
+    std::size_t mFree;
+};
+
+}
+
+#endif // PHRARY_ARENA_P_H
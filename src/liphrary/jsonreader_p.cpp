@@ -0,0 +1,631 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "jsonreader_p.h"
+
+#include <cctype>
+
+using namespace Phrary;
+
+static inline bool isJsonWhitespace(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static inline int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static void appendUtf8(QByteArray &out, uint ucs4)
+{
+    if (ucs4 < 0x80) {
+        out.append(static_cast<char>(ucs4));
+    } else if (ucs4 < 0x800) {
+        out.append(static_cast<char>(0xc0 | (ucs4 >> 6)));
+        out.append(static_cast<char>(0x80 | (ucs4 & 0x3f)));
+    } else if (ucs4 < 0x10000) {
+        out.append(static_cast<char>(0xe0 | (ucs4 >> 12)));
+        out.append(static_cast<char>(0x80 | ((ucs4 >> 6) & 0x3f)));
+        out.append(static_cast<char>(0x80 | (ucs4 & 0x3f)));
+    } else {
+        out.append(static_cast<char>(0xf0 | (ucs4 >> 18)));
+        out.append(static_cast<char>(0x80 | ((ucs4 >> 12) & 0x3f)));
+        out.append(static_cast<char>(0x80 | ((ucs4 >> 6) & 0x3f)));
+        out.append(static_cast<char>(0x80 | (ucs4 & 0x3f)));
+    }
+}
+
+JsonReader::JsonReader(const QByteArray &data)
+    : mBegin(data.constData())
+    , mPos(data.constData())
+    , mEnd(data.constData() + data.size())
+    , mError(Q_NULLPTR)
+{
+}
+
+JsonReader::JsonReader(const char *begin, const char *end)
+    : mBegin(begin)
+    , mPos(begin)
+    , mEnd(end)
+    , mError(Q_NULLPTR)
+{
+}
+
+bool JsonReader::hasError() const
+{
+    return mError != Q_NULLPTR;
+}
+
+QString JsonReader::errorString() const
+{
+    return mError ? QString::fromLatin1(mError) : QString();
+}
+
+bool JsonReader::atEnd()
+{
+    skipWhitespace();
+    return mPos == mEnd;
+}
+
+void JsonReader::setError(const char *error)
+{
+    if (!mError) {
+        mError = error;
+    }
+    mPos = mEnd;
+}
+
+void JsonReader::skipWhitespace()
+{
+    while (mPos < mEnd && isJsonWhitespace(*mPos)) {
+        ++mPos;
+    }
+}
+
+bool JsonReader::expect(char c)
+{
+    skipWhitespace();
+    if (mPos < mEnd && *mPos == c) {
+        ++mPos;
+        return true;
+    }
+    return false;
+}
+
+JsonReader::ValueType JsonReader::peekType()
+{
+    skipWhitespace();
+    if (mPos == mEnd) {
+        return InvalidValue;
+    }
+
+    switch (*mPos) {
+    case '{':
+        return ObjectValue;
+    case '[':
+        return ArrayValue;
+    case '"':
+        return StringValue;
+    case 't':
+    case 'f':
+        return BoolValue;
+    case 'n':
+        return NullValue;
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+        return NumberValue;
+    default:
+        return InvalidValue;
+    }
+}
+
+bool JsonReader::enterObject()
+{
+    switch (peekType()) {
+    case ObjectValue:
+        ++mPos;
+        return true;
+    case ArrayValue: {
+        // PHP's json_encode() turns empty maps into empty arrays
+        const char *pos = mPos;
+        ++mPos;
+        if (expect(']')) {
+            // Pretend we are inside an object that is about to end
+            --mPos;
+            return true;
+        }
+        mPos = pos;
+        skipValue();
+        return false;
+    }
+    case InvalidValue:
+        setError("unexpected character or end of document, expected an object");
+        return false;
+    default:
+        skipValue();
+        return false;
+    }
+}
+
+bool JsonReader::nextKey(QByteArray &key)
+{
+    skipWhitespace();
+    if (mPos == mEnd) {
+        setError("unexpected end of document inside an object");
+        return false;
+    }
+    // ']' closes the empty array accepted by enterObject()
+    if (*mPos == '}' || *mPos == ']') {
+        ++mPos;
+        return false;
+    }
+    if (*mPos == ',') {
+        ++mPos;
+        skipWhitespace();
+    }
+    if (mPos == mEnd || *mPos != '"') {
+        setError("expected an object key");
+        return false;
+    }
+
+    key = readStringLiteral();
+    if (!expect(':')) {
+        setError("expected ':' after an object key");
+        return false;
+    }
+    return true;
+}
+
+bool JsonReader::enterArray()
+{
+    switch (peekType()) {
+    case ArrayValue:
+        ++mPos;
+        return true;
+    case InvalidValue:
+        setError("unexpected character or end of document, expected an array");
+        return false;
+    default:
+        skipValue();
+        return false;
+    }
+}
+
+bool JsonReader::nextElement()
+{
+    skipWhitespace();
+    if (mPos == mEnd) {
+        setError("unexpected end of document inside an array");
+        return false;
+    }
+    if (*mPos == ']') {
+        ++mPos;
+        return false;
+    }
+    if (*mPos == ',') {
+        ++mPos;
+    }
+    return true;
+}
+
+QByteArray JsonReader::readStringLiteral()
+{
+    // mPos points to the opening quote
+    ++mPos;
+    const char *start = mPos;
+
+    // Fast path: no escape sequences, which is the vast majority of strings
+    while (mPos < mEnd && *mPos != '"' && *mPos != '\\') {
+        ++mPos;
+    }
+    if (mPos == mEnd) {
+        setError("unterminated string");
+        return QByteArray();
+    }
+    if (*mPos == '"') {
+        return QByteArray(start, static_cast<int>(mPos++ - start));
+    }
+
+    QByteArray out(start, static_cast<int>(mPos - start));
+    while (mPos < mEnd && *mPos != '"') {
+        if (*mPos != '\\') {
+            const char *runStart = mPos;
+            while (mPos < mEnd && *mPos != '"' && *mPos != '\\') {
+                ++mPos;
+            }
+            out.append(runStart, static_cast<int>(mPos - runStart));
+            continue;
+        }
+
+        if (++mPos == mEnd) {
+            break;
+        }
+        switch (*mPos++) {
+        case '"':  out.append('"');  break;
+        case '\\': out.append('\\'); break;
+        case '/':  out.append('/');  break;
+        case 'b':  out.append('\b'); break;
+        case 'f':  out.append('\f'); break;
+        case 'n':  out.append('\n'); break;
+        case 'r':  out.append('\r'); break;
+        case 't':  out.append('\t'); break;
+        case 'u': {
+            uint ucs4 = 0;
+            for (int i = 0; i < 4; ++i) {
+                const int v = (mPos < mEnd) ? hexValue(*mPos++) : -1;
+                if (v < 0) {
+                    setError("invalid \\u escape sequence");
+                    return QByteArray();
+                }
+                ucs4 = (ucs4 << 4) | static_cast<uint>(v);
+            }
+            // Surrogate pair
+            if (ucs4 >= 0xd800 && ucs4 < 0xdc00 && mEnd - mPos >= 6 && mPos[0] == '\\' && mPos[1] == 'u') {
+                uint low = 0;
+                bool ok = true;
+                for (int i = 2; i < 6; ++i) {
+                    const int v = hexValue(mPos[i]);
+                    ok = ok && v >= 0;
+                    low = (low << 4) | static_cast<uint>(v);
+                }
+                if (ok && low >= 0xdc00 && low < 0xe000) {
+                    ucs4 = 0x10000 + ((ucs4 - 0xd800) << 10) + (low - 0xdc00);
+                    mPos += 6;
+                }
+            }
+            appendUtf8(out, ucs4);
+            break;
+        }
+        default:
+            setError("invalid escape sequence");
+            return QByteArray();
+        }
+    }
+
+    if (mPos == mEnd) {
+        setError("unterminated string");
+        return QByteArray();
+    }
+    ++mPos; // closing quote
+    return out;
+}
+
+bool JsonReader::skipLiteral()
+{
+    const char *start = mPos;
+    while (mPos < mEnd && (std::isalnum(static_cast<unsigned char>(*mPos))
+                           || *mPos == '-' || *mPos == '+' || *mPos == '.')) {
+        ++mPos;
+    }
+    return mPos != start;
+}
+
+QByteArray JsonReader::readLiteral()
+{
+    const char *start = mPos;
+    skipLiteral();
+    return QByteArray(start, static_cast<int>(mPos - start));
+}
+
+QByteArray JsonReader::readUtf8()
+{
+    switch (peekType()) {
+    case StringValue:
+        return readStringLiteral();
+    case NumberValue:
+    case BoolValue:
+        return readLiteral();
+    case NullValue:
+        skipLiteral();
+        return QByteArray();
+    case InvalidValue:
+        setError("unexpected character or end of document, expected a value");
+        return QByteArray();
+    default:
+        skipValue();
+        return QByteArray();
+    }
+}
+
+QString JsonReader::readString()
+{
+    return QString::fromUtf8(readUtf8());
+}
+
+qint64 JsonReader::readInt()
+{
+    if (peekType() == NumberValue) {
+        // Parse directly, without creating a temporary QByteArray
+        bool negative = false;
+        if (*mPos == '-') {
+            negative = true;
+            ++mPos;
+        }
+        qint64 value = 0;
+        while (mPos < mEnd && *mPos >= '0' && *mPos <= '9') {
+            value = value * 10 + (*mPos++ - '0');
+        }
+        // Skip the fractional part and exponent, if any
+        skipLiteral();
+        return negative ? -value : value;
+    }
+
+    // Conduit likes to send numbers as strings
+    const QByteArray literal = readUtf8();
+    bool ok = false;
+    const qint64 value = literal.toLongLong(&ok);
+    return ok ? value : static_cast<qint64>(literal.toDouble());
+}
+
+bool JsonReader::readBool()
+{
+    const QByteArray literal = readUtf8();
+    return !(literal.isEmpty() || literal == "0" || literal == "false");
+}
+
+QVector<QByteArray> JsonReader::readUtf8List()
+{
+    QVector<QByteArray> list;
+    if (enterArray()) {
+        while (nextElement()) {
+            list.push_back(readUtf8());
+        }
+    }
+    return list;
+}
+
+PhidRef JsonReader::readPhid()
+{
+    if (peekType() == StringValue) {
+        // PHIDs never contain escape sequences
+        const char *start = mPos + 1;
+        const char *end = start;
+        while (end < mEnd && *end != '"' && *end != '\\') {
+            ++end;
+        }
+        if (end < mEnd && *end == '"') {
+            mPos = end + 1;
+            return PhidRef(start, static_cast<int>(end - start));
+        }
+    }
+
+    return PhidRef(readUtf8());
+}
+
+QVector<PhidRef> JsonReader::readPhidList()
+{
+    QVector<PhidRef> list;
+    if (enterArray()) {
+        while (nextElement()) {
+            list.push_back(readPhid());
+        }
+    }
+    return list;
+}
+
+QStringList JsonReader::readStringList()
+{
+    QStringList list;
+    if (enterArray()) {
+        while (nextElement()) {
+            list.push_back(readString());
+        }
+    }
+    return list;
+}
+
+void JsonReader::skipValue()
+{
+    int depth = 0;
+    do {
+        skipWhitespace();
+        if (mPos == mEnd) {
+            setError("unexpected end of document");
+            return;
+        }
+
+        switch (*mPos) {
+        case '{':
+        case '[':
+            ++depth;
+            ++mPos;
+            break;
+        case '}':
+        case ']':
+            if (depth == 0) {
+                setError("unexpected end of object or array");
+                return;
+            }
+            --depth;
+            ++mPos;
+            break;
+        case ',':
+        case ':':
+            if (depth == 0) {
+                setError("unexpected separator");
+                return;
+            }
+            ++mPos;
+            break;
+        case '"':
+            // Skip without unescaping
+            for (++mPos; mPos < mEnd && *mPos != '"'; ++mPos) {
+                if (*mPos == '\\') {
+                    ++mPos;
+                }
+            }
+            if (mPos >= mEnd) {
+                setError("unterminated string");
+                return;
+            }
+            ++mPos;
+            break;
+        default:
+            if (!skipLiteral()) {
+                setError("unexpected character");
+                return;
+            }
+            break;
+        }
+    } while (depth > 0);
+}
+
+
+
+JsonResultSplitter::JsonResultSplitter(const ElementHandler &handler)
+    : mHandler(handler)
+    , mDepth(0)
+    , mInString(false)
+    , mEscape(false)
+    , mExpectKey(false)
+    , mCapturingKey(false)
+    , mStreaming(false)
+    , mObjectResult(false)
+{
+}
+
+bool JsonResultSplitter::hasError() const
+{
+    return !mError.isEmpty();
+}
+
+QString JsonResultSplitter::errorString() const
+{
+    return mError;
+}
+
+QByteArray JsonResultSplitter::envelope() const
+{
+    return mEnvelope;
+}
+
+void JsonResultSplitter::append(const QByteArray &data)
+{
+    const char *pos = data.constData();
+    const char *const end = pos + data.size();
+    // Start of the data not yet copied to mBuffer or mEnvelope
+    const char *run = pos;
+
+    for (; pos < end; ++pos) {
+        const char c = *pos;
+        if (mInString) {
+            if (mEscape) {
+                mEscape = false;
+            } else if (c == '\\') {
+                mEscape = true;
+            } else if (c == '"') {
+                mInString = false;
+                mCapturingKey = false;
+            } else if (mCapturingKey) {
+                mKey.append(c);
+            }
+            continue;
+        }
+
+        switch (c) {
+        case '"':
+            mInString = true;
+            if (mDepth == 1 && mExpectKey) {
+                mKey.clear();
+                mCapturingKey = true;
+                mExpectKey = false;
+            }
+            break;
+        case '{':
+        case '[':
+            ++mDepth;
+            if (mDepth == 1) {
+                mExpectKey = (c == '{');
+            } else if (mDepth == 2 && mKey == "result") {
+                mEnvelope.append(run, pos + 1 - run);
+                run = pos + 1;
+                mStreaming = true;
+                mObjectResult = (c == '{');
+            }
+            break;
+        case ',':
+            if (mDepth == 1) {
+                mExpectKey = true;
+            } else if (mDepth == 2 && mStreaming) {
+                flushElement(run, pos);
+                run = pos + 1;
+            }
+            break;
+        case '}':
+        case ']':
+            if (mDepth == 2 && mStreaming) {
+                flushElement(run, pos);
+                run = pos;
+                mStreaming = false;
+                mKey.clear();
+            }
+            --mDepth;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (mStreaming) {
+        mBuffer.append(run, end - run);
+    } else {
+        mEnvelope.append(run, end - run);
+    }
+}
+
+void JsonResultSplitter::flushElement(const char *begin, const char *end)
+{
+    if (!mBuffer.isEmpty()) {
+        mBuffer.append(begin, end - begin);
+        begin = mBuffer.constData();
+        end = begin + mBuffer.size();
+    }
+
+    JsonReader reader(begin, end);
+    // Skip the whitespace between the last element and the closing bracket
+    if (!reader.atEnd()) {
+        QByteArray key;
+        if (!mObjectResult || reader.nextKey(key)) {
+            mHandler(key, reader);
+        }
+        if (!reader.hasError() && !reader.atEnd()) {
+            reader.skipValue();
+        }
+        if (mError.isEmpty()) {
+            if (reader.hasError()) {
+                mError = reader.errorString();
+            } else if (!reader.atEnd()) {
+                mError = QStringLiteral("unexpected data after a result element");
+            }
+        }
+    }
+
+    mBuffer.clear();
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PHRARY_JSONREADER_P_H
+#define PHRARY_JSONREADER_P_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <functional>
+
+#include "phid.h"
+
+namespace Phrary
+{
+
+/**
+ * A minimal pull parser for JSON documents.
+ *
+ * Unlike QJsonDocument it does not build any intermediate representation of
+ * the document, the caller walks through it and picks the values it's
+ * interested in directly from the UTF-8 buffer. Everything else is skipped
+ * without being decoded.
+ *
+ * The reader is lenient where Conduit needs it to be: empty JSON arrays are
+ * accepted as empty objects (PHP encodes empty maps as []), and numbers
+ * and booleans can be read from strings.
+ *
+ * On error the reader jumps to the end of the document, so all loops
+ * terminate, and hasError() returns true.
+ */
+class JsonReader
+{
+public:
+    enum ValueType {
+        InvalidValue,
+        NullValue,
+        BoolValue,
+        NumberValue,
+        StringValue,
+        ArrayValue,
+        ObjectValue
+    };
+
+    /**
+     * The reader does not copy @p data, it must outlive the reader.
+     */
+    explicit JsonReader(const QByteArray &data);
+    JsonReader(const char *begin, const char *end);
+
+    bool hasError() const;
+    QString errorString() const;
+    bool atEnd();
+
+    ValueType peekType();
+
+    /**
+     * Enters an object. Returns false and skips the value if the next value
+     * is not an object.
+     */
+    bool enterObject();
+
+    /**
+     * Reads the next key of the current object. Returns false when the end
+     * of the object is reached.
+     */
+    bool nextKey(QByteArray &key);
+
+    /**
+     * Enters an array. Returns false and skips the value if the next value
+     * is not an array.
+     */
+    bool enterArray();
+
+    /**
+     * Returns true when there is another element in the current array,
+     * or false when the end of the array is reached.
+     */
+    bool nextElement();
+
+    /**
+     * Reads a string, or the literal text of a number or a boolean, as
+     * UTF-8. Returns an empty array for null and skips objects and arrays.
+     */
+    QByteArray readUtf8();
+    QString readString();
+    qint64 readInt();
+    bool readBool();
+
+    QVector<QByteArray> readUtf8List();
+    QStringList readStringList();
+
+    /**
+     * Reads a string and interns it in the PHID pool. PHIDs that are already
+     * in the pool are looked up directly in the document without any copy.
+     */
+    PhidRef readPhid();
+    QVector<PhidRef> readPhidList();
+
+    void skipValue();
+
+private:
+    void skipWhitespace();
+    bool expect(char c);
+    void setError(const char *error);
+    QByteArray readStringLiteral();
+    bool skipLiteral();
+    QByteArray readLiteral();
+
+    const char *mBegin;
+    const char *mPos;
+    const char *mEnd;
+    const char *mError;
+};
+
+/**
+ * Splits a Conduit response into the elements of its "result" value while
+ * the response is still being received.
+ *
+ * The data can be fed in chunks of any size. Whenever a member of the result
+ * object, or an item of the result array, is complete it is passed to the
+ * handler and the splitter forgets about it, so at most one element is
+ * buffered at a time. Everything else (the result's brackets, error_code
+ * and error_info) is collected into envelope() to be decoded once the
+ * response is finished.
+ *
+ * The splitter only tracks the nesting of the document, validation is left
+ * to the JsonReader that decodes the elements and the envelope.
+ */
+class JsonResultSplitter
+{
+public:
+    /**
+     * @p key is the member name for elements of a result object and empty
+     * for items of a result array. The @p reader is positioned at the value.
+     */
+    typedef std::function<void(const QByteArray &key, JsonReader &reader)> ElementHandler;
+
+    explicit JsonResultSplitter(const ElementHandler &handler);
+
+    void append(const QByteArray &data);
+
+    bool hasError() const;
+    QString errorString() const;
+
+    /**
+     * The response with all the elements of the result removed.
+     */
+    QByteArray envelope() const;
+
+private:
+    void flushElement(const char *begin, const char *end);
+
+    ElementHandler mHandler;
+    QByteArray mBuffer;
+    QByteArray mEnvelope;
+    QByteArray mKey;
+    QString mError;
+    int mDepth;
+    bool mInString;
+    bool mEscape;
+    bool mExpectKey;
+    bool mCapturingKey;
+    bool mStreaming;
+    bool mObjectResult;
+};
+
+}
+
+#endif // PHRARY_JSONREADER_P_H
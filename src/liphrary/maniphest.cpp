@@ -22,22 +22,133 @@
 #include "maniphest.h"
 #include "server.h"
 #include "utils_p.h"
+#include "jsonreader_p.h"
+#include "arena_p.h"
 
 #include <QByteArray>
 #include <QUrl>
-#include <QUrlQuery>
+#include <QJsonArray>
+#include <QJsonObject>
 #include <QDateTime>
-#include <QJsonDocument>
-
-#include <KIO/StoredTransferJob>
 
 using namespace Phrary;
 
+struct PriorityInfo {
+    Maniphest::TaskPriority priority;
+    const char *name;
+    const char *color;
+    int iCalPriority;
+};
+
+// Ordered from the most important one, like in Phabricator
+static const PriorityInfo Priorities[] = {
+    { Maniphest::UnbreakNowPriority,  "Unbreak Now!", "pink",   9 },
+    { Maniphest::NeedsTriagePriority, "Needs Triage", "violet", 0 },
+    { Maniphest::HighPriority,        "High",         "red",    7 },
+    { Maniphest::NormalPriority,      "Normal",       "orange", 5 },
+    { Maniphest::LowPriority,         "Low",          "yellow", 3 },
+    { Maniphest::WishlistPriority,    "Wishlist",     "sky",    1 }
+};
+
+struct StatusInfo {
+    Maniphest::TaskStatus status;
+    const char *id;
+    const char *name;
+};
+
+static const StatusInfo Statuses[] = {
+    { Maniphest::OpenStatus,      "open",      "Open" },
+    { Maniphest::ResolvedStatus,  "resolved",  "Resolved" },
+    { Maniphest::WontfixStatus,   "wontfix",   "Wontfix" },
+    { Maniphest::InvalidStatus,   "invalid",   "Invalid" },
+    { Maniphest::DuplicateStatus, "duplicate", "Duplicate" },
+    { Maniphest::SpiteStatus,     "spite",     "Spite" }
+};
+
+static const PriorityInfo *findPriority(Maniphest::TaskPriority priority)
+{
+    for (const PriorityInfo &info : Priorities) {
+        if (info.priority == priority) {
+            return &info;
+        }
+    }
+    return Q_NULLPTR;
+}
+
+/**
+ * Conduit sends the name of the priority, but accept its numeric value too
+ */
+static Maniphest::TaskPriority priorityFromString(const QByteArray &priority)
+{
+    for (const PriorityInfo &info : Priorities) {
+        if (priority == info.name) {
+            return info.priority;
+        }
+    }
+
+    bool ok = false;
+    const int value = priority.toInt(&ok);
+    if (ok && findPriority(static_cast<Maniphest::TaskPriority>(value))) {
+        return static_cast<Maniphest::TaskPriority>(value);
+    }
+    return Maniphest::UnknownPriority;
+}
+
+static Maniphest::TaskPriority priorityFromColor(const QByteArray &color)
+{
+    for (const PriorityInfo &info : Priorities) {
+        if (color == info.color) {
+            return info.priority;
+        }
+    }
+    return Maniphest::UnknownPriority;
+}
+
+static Maniphest::TaskStatus statusFromString(const QByteArray &status)
+{
+    for (const StatusInfo &info : Statuses) {
+        if (status == info.id) {
+            return info.status;
+        }
+    }
+    return Maniphest::UnknownStatus;
+}
+
+QString Maniphest::priorityName(TaskPriority priority)
+{
+    const PriorityInfo *info = findPriority(priority);
+    return info ? QString::fromLatin1(info->name) : QString();
+}
+
+QString Maniphest::priorityColor(TaskPriority priority)
+{
+    const PriorityInfo *info = findPriority(priority);
+    return info ? QString::fromLatin1(info->color) : QString();
+}
+
+int Maniphest::iCalPriority(TaskPriority priority)
+{
+    const PriorityInfo *info = findPriority(priority);
+    return info ? info->iCalPriority : 0;
+}
+
+QString Maniphest::statusName(TaskStatus status)
+{
+    for (const StatusInfo &info : Statuses) {
+        if (info.status == status) {
+            return QString::fromLatin1(info.name);
+        }
+    }
+    return QString();
+}
+
 class Maniphest::Task::Private : public QSharedData
 {
 public:
     Private()
         : QSharedData()
+        , status(UnknownStatus)
+        , priority(UnknownPriority)
     {
     }
 
@@ -49,10 +160,9 @@ public:
         , ownerPHID(other.ownerPHID)
         , ccPHIDs(other.ccPHIDs)
         , status(other.status)
-        , statusName(other.statusName)
+        , customStatusName(other.customStatusName)
         , isClosed(other.isClosed)
         , priority(other.priority)
-        , priorityColor(other.priorityColor)
         , title(other.title)
         , description(other.description)
         , projectPHIDs(other.projectPHIDs)
@@ -68,65 +178,94 @@ public:
     {
     }
 
-    static Task::List parse(const QVariant &data)
+    // Allocated from the response's arena while the response is decoded
+    static void *operator new(std::size_t size)
     {
-        const QVariantMap results = data.toMap();
-        Task::List tasks;
-        tasks.reserve(results.size());
-
-        for (auto iter = results.cbegin(), end = results.cend(); iter != end; ++iter) {
-            const QVariantMap d = iter.value().toMap();
-            Task task;
-            task.d_ptr->phid = iter.key().toLatin1();
-            task.d_ptr->id = d[QStringLiteral("id")].toUInt();
-            task.d_ptr->authorPHID = d[QStringLiteral("authorPHID")].toByteArray();
-            task.d_ptr->ownerPHID = d[QStringLiteral("ownerPHID")].toByteArray();
-            const QVariantList ccPHIDs = d[QStringLiteral("ccPHIDs")].toList();
-            task.d_ptr->ccPHIDs.reserve(ccPHIDs.size());
-            Q_FOREACH (const QVariant &ccPHID, ccPHIDs) {
-                task.d_ptr->ccPHIDs.push_back(ccPHID.toByteArray());
-            }
-            task.d_ptr->status = d[QStringLiteral("status")].toString();
-            task.d_ptr->statusName = d[QStringLiteral("statusName")].toString();
-            task.d_ptr->isClosed = d[QStringLiteral("isClosed")].toBool();
-            task.d_ptr->priority = d[QStringLiteral("priority")].toString();
-            task.d_ptr->priorityColor = d[QStringLiteral("priorityColor")].toString();
-            task.d_ptr->title = d[QStringLiteral("title")].toString();
-            task.d_ptr->description = d[QStringLiteral("description")].toString();
-            const QVariantList projectPHIDs = d[QStringLiteral("projectPHIDs")].toList();
-            task.d_ptr->projectPHIDs.reserve(projectPHIDs.size());
-            Q_FOREACH (const QVariant &projectPHID, projectPHIDs) {
-                task.d_ptr->projectPHIDs.push_back(projectPHID.toByteArray());
-            }
-            task.d_ptr->uri = d[QStringLiteral("uri")].toUrl();
-            task.d_ptr->objectName = d[QStringLiteral("objectName")].toByteArray();
-            task.d_ptr->dateCreated = QDateTime::fromTime_t(d[QStringLiteral("dateCreated")].toUInt());
-            task.d_ptr->dateModified = QDateTime::fromTime_t(d[QStringLiteral("dateModified")].toUInt());
-            const QVariantList dependsPHIDs = d[QStringLiteral("dependsOnTaskPHIDs")].toList();
-            task.d_ptr->dependsOnTaskPHIDs.reserve(dependsPHIDs.size());
-            Q_FOREACH (const QVariant &dependsPHID, dependsPHIDs) {
-                task.d_ptr->dependsOnTaskPHIDs.push_back(dependsPHID.toByteArray());
+        return Arena::allocate(size);
+    }
+
+    static void operator delete(void *ptr)
+    {
+        Arena::deallocate(ptr);
+    }
+
+    /**
+     * Parses a single "phid": {task} member of the maniphest.query result.
+     */
+    static void parseElement(const QByteArray &phid, JsonReader &reader, Task::List &tasks)
+    {
+        if (!reader.enterObject()) {
+            return;
+        }
+
+        QByteArray key, priorityColor;
+        Task task;
+        task.d_ptr->phid = phid;
+        while (reader.nextKey(key)) {
+            if (key == "id") {
+                task.d_ptr->id = static_cast<uint>(reader.readInt());
+            } else if (key == "authorPHID") {
+                task.d_ptr->authorPHID = reader.readPhid();
+            } else if (key == "ownerPHID") {
+                task.d_ptr->ownerPHID = reader.readPhid();
+            } else if (key == "ccPHIDs") {
+                task.d_ptr->ccPHIDs = reader.readPhidList();
+            } else if (key == "status") {
+                task.d_ptr->status = statusFromString(reader.readUtf8());
+            } else if (key == "statusName" && task.d_ptr->status == UnknownStatus) {
+                task.d_ptr->customStatusName = reader.readString();
+            } else if (key == "isClosed") {
+                task.d_ptr->isClosed = reader.readBool();
+            } else if (key == "priority") {
+                task.d_ptr->priority = priorityFromString(reader.readUtf8());
+            } else if (key == "priorityColor") {
+                priorityColor = reader.readUtf8();
+            } else if (key == "title") {
+                task.d_ptr->title = reader.readString();
+            } else if (key == "description") {
+                task.d_ptr->description = reader.readString();
+            } else if (key == "projectPHIDs") {
+                task.d_ptr->projectPHIDs = reader.readPhidList();
+            } else if (key == "uri") {
+                task.d_ptr->uri = QUrl(reader.readString());
+            } else if (key == "objectName") {
+                task.d_ptr->objectName = reader.readUtf8();
+            } else if (key == "dateCreated") {
+                task.d_ptr->dateCreated = QDateTime::fromTime_t(static_cast<uint>(reader.readInt()));
+            } else if (key == "dateModified") {
+                task.d_ptr->dateModified = QDateTime::fromTime_t(static_cast<uint>(reader.readInt()));
+            } else if (key == "dependsOnTaskPHIDs") {
+                task.d_ptr->dependsOnTaskPHIDs = reader.readUtf8List();
+            } else {
+                reader.skipValue();
             }
+        }
 
-            tasks.push_back(task);
+        // Conduit sends "statusName" after "status", but don't rely on it
+        if (task.d_ptr->status != UnknownStatus) {
+            task.d_ptr->customStatusName.clear();
         }
 
-        return tasks;
+        // Instances may rename the priorities, but they rarely change the colors
+        if (task.d_ptr->priority == UnknownPriority && !priorityColor.isEmpty()) {
+            task.d_ptr->priority = priorityFromColor(priorityColor);
+        }
+
+        tasks.push_back(task);
     }
 
     QByteArray phid;
     uint id;
-    QByteArray authorPHID;
-    QByteArray ownerPHID;
-    QVector<QByteArray> ccPHIDs;
-    QString status;
-    QString statusName;
+    PhidRef authorPHID;
+    PhidRef ownerPHID;
+    QVector<PhidRef> ccPHIDs;
+    TaskStatus status;
+    QString customStatusName;
     bool isClosed;
-    QString priority;
-    QString priorityColor;
+    TaskPriority priority;
     QString title;
     QString description;
-    QVector<QByteArray> projectPHIDs;
+    QVector<PhidRef> projectPHIDs;
     QUrl uri;
     QByteArray objectName;
     QDateTime dateCreated;
@@ -168,53 +307,57 @@ void Maniphest::Task::setId(uint id)
     d_ptr->id = id;
 }
 
-QByteArray Maniphest::Task::authorPHID() const
+PhidRef Maniphest::Task::authorPHID() const
 {
     return d_ptr->authorPHID;
 }
 
-void Maniphest::Task::setAuthorPHID(const QByteArray &authorPHID)
+void Maniphest::Task::setAuthorPHID(const PhidRef &authorPHID)
 {
     d_ptr->authorPHID = authorPHID;
 }
 
-QByteArray Maniphest::Task::ownerPHID() const
+PhidRef Maniphest::Task::ownerPHID() const
 {
     return d_ptr->ownerPHID;
 }
 
-void Maniphest::Task::setOwnerPHID(const QByteArray &ownerPHID)
+void Maniphest::Task::setOwnerPHID(const PhidRef &ownerPHID)
 {
     d_ptr->ownerPHID = ownerPHID;
 }
 
-QVector<QByteArray> Maniphest::Task::ccPHIDs() const
+QVector<PhidRef> Maniphest::Task::ccPHIDs() const
 {
     return d_ptr->ccPHIDs;
 }
 
-void Maniphest::Task::setCcPHIDs(const QVector<QByteArray> &ccPHIDs)
+void Maniphest::Task::setCcPHIDs(const QVector<PhidRef> &ccPHIDs)
 {
     d_ptr->ccPHIDs = ccPHIDs;
 }
 
-QString Maniphest::Task::status() const
+Maniphest::TaskStatus Maniphest::Task::status() const
 {
     return d_ptr->status;
 }
 
-void Maniphest::Task::setStatus(const QString &status)
+void Maniphest::Task::setStatus(TaskStatus status)
 {
     d_ptr->status = status;
 }
 
 QString Maniphest::Task::statusName() const
 {
-    return d_ptr->statusName;
+    if (d_ptr->status == UnknownStatus) {
+        return d_ptr->customStatusName;
+    }
+    return Maniphest::statusName(d_ptr->status);
 }
+
 void Maniphest::Task::setStatusName(const QString &statusName)
 {
-    d_ptr->statusName = statusName;
+    d_ptr->customStatusName = statusName;
 }
 
 bool Maniphest::Task::isClosed() const
@@ -227,24 +370,24 @@ void Maniphest::Task::setIsClosed(bool isClosed)
     d_ptr->isClosed = isClosed;
 }
 
-QString Maniphest::Task::priority() const
+Maniphest::TaskPriority Maniphest::Task::priority() const
 {
     return d_ptr->priority;
 }
 
-void Maniphest::Task::setPriority(const QString &priority)
+void Maniphest::Task::setPriority(TaskPriority priority)
 {
     d_ptr->priority = priority;
 }
 
-QString Maniphest::Task::priorityColor() const
+QString Maniphest::Task::priorityName() const
 {
-    return d_ptr->priorityColor;
+    return Maniphest::priorityName(d_ptr->priority);
 }
 
-void Maniphest::Task::setPriorityColor(const QString &priorityColor)
+QString Maniphest::Task::priorityColor() const
 {
-    d_ptr->priorityColor = priorityColor;
+    return Maniphest::priorityColor(d_ptr->priority);
 }
 
 QString Maniphest::Task::title() const
@@ -267,11 +410,11 @@ void Maniphest::Task::setDescription(const QString &description)
     d_ptr->description = description;
 }
 
-QVector<QByteArray> Maniphest::Task::projectPHIDs() const
+QVector<PhidRef> Maniphest::Task::projectPHIDs() const
 {
     return d_ptr->projectPHIDs;
 }
-void Maniphest::Task::setProjectPHIDs(const QVector<QByteArray> &projectPHIDs)
+void Maniphest::Task::setProjectPHIDs(const QVector<PhidRef> &projectPHIDs)
 {
     d_ptr->projectPHIDs = projectPHIDs;
 }
@@ -325,50 +468,146 @@ void Maniphest::Task::setDependsOnTaskPHIDs(const QVector<QByteArray> &dependsOn
     d_ptr->dependsOnTaskPHIDs = dependsOn;
 }
 
-KAsync::Job<Maniphest::Task::List, Server> Maniphest::queryTasksByProject(const QString &projectPHID, int offset)
+static QString taskOrderToString(Maniphest::TaskOrder order)
+{
+    switch (order) {
+    case Maniphest::OrderByPriority:
+        return QStringLiteral("order-priority");
+    case Maniphest::OrderByCreated:
+        return QStringLiteral("order-created");
+    case Maniphest::OrderByModified:
+        return QStringLiteral("order-modified");
+    case Maniphest::DefaultOrder:
+        break;
+    }
+    return QString();
+}
+
+KAsync::Job<Maniphest::Task::List, Server> Maniphest::queryTasksByProject(const QString &projectPHID, int offset,
+                                                                          int limit, TaskOrder order)
+{
+    return queryTasksByProject(projectPHID, offset, limit, order, TaskHandler());
+}
+
+KAsync::Job<Maniphest::Task::List, Server> Maniphest::queryTasksByProject(const QString &projectPHID, int offset,
+                                                                          int limit, TaskOrder order,
+                                                                          const TaskHandler &onTasks)
 {
-    return KAsync::start<QUrl, Server>(
-        [projectPHID, offset](const Server &server)
+    return KAsync::start<Request, Server>(
+        [projectPHID, offset, limit, order](const Server &server)
         {
-            QUrlQuery query;
-            query.addQueryItem(QStringLiteral("api.token"), server.apiToken());
+            QJsonObject params;
             if (!projectPHID.isEmpty()) {
-                query.addQueryItem(QStringLiteral("projectPHIDs[0]"), projectPHID);
+                params[QStringLiteral("projectPHIDs")] = QJsonArray::fromStringList(QStringList{ projectPHID });
             }
             if (offset > 0) {
-                query.addQueryItem(QStringLiteral("offset"), QString::number(offset));
+                params[QStringLiteral("offset")] = offset;
+            }
+            if (limit > 0) {
+                params[QStringLiteral("limit")] = limit;
+            }
+            if (order != DefaultOrder) {
+                params[QStringLiteral("order")] = taskOrderToString(order);
             }
 
-            QUrl url(server.server());
-            url.setPath(QStringLiteral("/api/maniphest.query"));
-            url.setQuery(query);
-            return url;
+            return Request{ server, QStringLiteral("maniphest.query"), params };
         })
-    .then<Maniphest::Task::List, QUrl>(&Phrary::parseResponse<Maniphest::Task>);
+    .then<Maniphest::Task::List, Request>(
+        [onTasks](const Request &request, KAsync::Future<Maniphest::Task::List> &future) {
+            streamResponse<Maniphest::Task>(request, future, onTasks);
+        });
+}
+
+static void queryModifiedTasksPage(const Server &server, const QString &projectPHID, const QDateTime &since,
+                                   int offset, int limit, const Maniphest::Task::List &collected,
+                                   const KAsync::Future<Maniphest::Task::List> &future)
+{
+    static const int MaxPageSize = 1000;
+
+    auto watcher = new KAsync::FutureWatcher<Maniphest::Task::List>();
+    QObject::connect(watcher, &KAsync::FutureWatcherBase::futureReady,
+        [watcher, server, projectPHID, since, offset, limit, collected, future]() {
+            auto f = future;
+            const auto pageFuture = watcher->future();
+            watcher->deleteLater();
+            if (pageFuture.errorCode()) {
+                f.setError(pageFuture.errorCode(), pageFuture.errorMessage());
+                return;
+            }
+
+            // The result is keyed by PHID so the order within the page is lost,
+            // but the page as a whole is still the next slice of most recently
+            // modified tasks
+            const Maniphest::Task::List page = pageFuture.value();
+            Maniphest::Task::List tasks = collected;
+            bool reachedOlder = false;
+            for (const auto &task : page) {
+                if (task.dateModified() >= since) {
+                    tasks.push_back(task);
+                } else {
+                    reachedOlder = true;
+                }
+            }
+
+            if (reachedOlder || page.size() < limit) {
+                f.setValue(tasks);
+                f.setFinished();
+            } else {
+                queryModifiedTasksPage(server, projectPHID, since, offset + page.size(),
+                                       qMin(limit * 2, MaxPageSize), tasks, f);
+            }
+        });
+    watcher->setFuture(Maniphest::queryTasksByProject(projectPHID, offset, limit, Maniphest::OrderByModified)
+                           .exec(server));
 }
 
-KAsync::Job<Maniphest::Task::List, Server> Maniphest::queryTasksByPHID(const QStringList &taskPHIDs, int offset)
+KAsync::Job<Maniphest::Task::List, Server> Maniphest::queryTasksByProjectModifiedSince(const QString &projectPHID,
+                                                                                       const QDateTime &since)
 {
-    return KAsync::start<QUrl, Server>(
-        [taskPHIDs, offset](const Server &server)
+    static const int InitialPageSize = 10;
+
+    return KAsync::start<Maniphest::Task::List, Server>(
+        [projectPHID, since](const Server &server, KAsync::Future<Maniphest::Task::List> &future)
         {
-            QUrlQuery query;
-            query.addQueryItem(QStringLiteral("api.token"), server.apiToken());
-            for (int i = 0; i < taskPHIDs.count(); ++i) {
-                query.addQueryItem(QStringLiteral("ids[%i]").arg(i),
-                                   taskPHIDs.at(i));
-            }
-            if (offset > 0) {
-                query.addQueryItem(QStringLiteral("offset"),
-                                   QString::number(offset));
+            queryModifiedTasksPage(server, projectPHID, since, 0, InitialPageSize,
+                                   Maniphest::Task::List(), future);
+        });
+}
+
+static KAsync::Job<Maniphest::Task::List, Server> queryTasksChunk(const QVector<QString> &taskPHIDs)
+{
+    return KAsync::start<Request, Server>(
+        [taskPHIDs](const Server &server)
+        {
+            QJsonArray phids;
+            for (const QString &phid : taskPHIDs) {
+                phids.push_back(phid);
             }
+            QJsonObject params;
+            params[QStringLiteral("phids")] = phids;
+            // maniphest.query returns only 100 tasks by default
+            params[QStringLiteral("limit")] = taskPHIDs.size();
 
-            QUrl url(server.server());
-            url.setPath(QStringLiteral("/api/maniphest.query"));
-            url.setQuery(query);
-            return url;
+            return Request{ server, QStringLiteral("maniphest.query"), params };
         })
-    .then<Maniphest::Task::List, QUrl>(&Phrary::parseResponse<Maniphest::Task>);
+    .then<Maniphest::Task::List, Request>(&Phrary::parseResponse<Maniphest::Task>);
+}
+
+KAsync::Job<Maniphest::Task::List, Server> Maniphest::queryTasksByPHID(const QStringList &taskPHIDs)
+{
+    // Tasks come with their full description, keep the responses small enough
+    // to be decoded while the other chunks are still downloading
+    static const int MaxPHIDsPerRequest = 100;
+
+    // An empty "phids" filter would match every task on the server
+    if (taskPHIDs.isEmpty()) {
+        return KAsync::start<Maniphest::Task::List, Server>(
+            [](const Server &) {
+                return Maniphest::Task::List();
+            });
+    }
+
+    return queryChunked<Maniphest::Task, QString>(taskPHIDs.toVector(), MaxPHIDsPerRequest, &queryTasksChunk);
 }
 
 
@@ -390,37 +629,60 @@ public:
         , dateCreated(other.dateCreated)
     {}
 
-    static Transaction::List parse(const QVariant &data)
+    static void *operator new(std::size_t size)
     {
-        const QVariantMap results = data.toMap();
-
-        Transaction::List trxs;
-        trxs.reserve(results.size());
-
-        for (auto iter = results.cbegin(), end = results.cend(); iter != end; ++iter) {
-            const QVariantList taskTransactions = iter.value().toList();
-            Q_FOREACH (const QVariant &dv, taskTransactions) {
-                const QVariantMap d = dv.toMap();
-                Transaction trx;
-                trx.d_ptr->taskId = iter.key().toInt();
-                trx.d_ptr->transactionPHID = d[QStringLiteral("transactionPHID")].toByteArray();
-                trx.d_ptr->transactionType = d[QStringLiteral("transactionType")].toByteArray();
-                trx.d_ptr->comments = d[QStringLiteral("comments")].toString();
-                trx.d_ptr->authorPHID = d[QStringLiteral("authorPHID")].toByteArray();
-                trx.d_ptr->dateCreated = QDateTime::fromTime_t(d[QStringLiteral("dateCreated")].toInt());
-
-                trxs.push_back(trx);
-            }
+        return Arena::allocate(size);
+    }
+
+    static void operator delete(void *ptr)
+    {
+        Arena::deallocate(ptr);
+    }
+
+    /**
+     * Parses a single "taskId": [transactions] member of the
+     * maniphest.gettasktransactions result.
+     */
+    static void parseElement(const QByteArray &taskId, JsonReader &reader, Transaction::List &trxs)
+    {
+        if (!reader.enterArray()) {
+            return;
         }
 
-        return trxs;
+        QByteArray key;
+        const int id = taskId.toInt();
+        while (reader.nextElement()) {
+            if (!reader.enterObject()) {
+                continue;
+            }
+
+            Transaction trx;
+            trx.d_ptr->taskId = id;
+            while (reader.nextKey(key)) {
+                if (key == "transactionPHID") {
+                    trx.d_ptr->transactionPHID = reader.readUtf8();
+                } else if (key == "transactionType") {
+                    trx.d_ptr->transactionType = reader.readUtf8();
+                } else if (key == "comments") {
+                    trx.d_ptr->comments = reader.readString();
+                } else if (key == "authorPHID") {
+                    trx.d_ptr->authorPHID = reader.readPhid();
+                } else if (key == "dateCreated") {
+                    trx.d_ptr->dateCreated = QDateTime::fromTime_t(static_cast<uint>(reader.readInt()));
+                } else {
+                    reader.skipValue();
+                }
+            }
+
+            trxs.push_back(trx);
+        }
     }
 
     int taskId;
     QByteArray transactionPHID;
     QByteArray transactionType;
     QString comments;
-    QByteArray authorPHID;
+    PhidRef authorPHID;
     QDateTime dateCreated;
 };
 
@@ -479,12 +741,12 @@ void Maniphest::Transaction::setComments(const QString &comments)
     d_ptr->comments = comments;
 }
 
-QByteArray Maniphest::Transaction::authorPHID() const
+PhidRef Maniphest::Transaction::authorPHID() const
 {
     return d_ptr->authorPHID;
 }
 
-void Maniphest::Transaction::setAuthorPHID(const QByteArray &authorPHID)
+void Maniphest::Transaction::setAuthorPHID(const PhidRef &authorPHID)
 {
     d_ptr->authorPHID = authorPHID;
 }
@@ -501,20 +763,26 @@ void Maniphest::Transaction::setDateCreated(const QDateTime &dateCreated)
 
 KAsync::Job<Maniphest::Transaction::List, Server> Maniphest::queryTransactionsByTask(const QVector<uint> &taskIds)
 {
-    return KAsync::start<QUrl, Server>(
+    return queryTransactionsByTask(taskIds, TransactionHandler());
+}
+
+KAsync::Job<Maniphest::Transaction::List, Server> Maniphest::queryTransactionsByTask(const QVector<uint> &taskIds,
+                                                                                    const TransactionHandler &onTransactions)
+{
+    return KAsync::start<Request, Server>(
         [taskIds](const Server &server)
         {
-            QUrlQuery query;
-            query.addQueryItem(QStringLiteral("api.token"), server.apiToken());
-            for (int i = 0; i < taskIds.count(); ++i) {
-                query.addQueryItem(QStringLiteral("ids[%1]").arg(i),
-                                   QString::number(taskIds.at(i)));
+            QJsonArray ids;
+            for (uint id : taskIds) {
+                ids.push_back(static_cast<qint64>(id));
             }
+            QJsonObject params;
+            params[QStringLiteral("ids")] = ids;
 
-            QUrl url(server.server());
-            url.setPath(QStringLiteral("/api/maniphest.gettasktransactions"));
-            url.setQuery(query);
-            return url;
+            return Request{ server, QStringLiteral("maniphest.gettasktransactions"), params };
         })
-    .then<Maniphest::Transaction::List, QUrl>(&Phrary::parseResponse<Maniphest::Transaction>);
+    .then<Maniphest::Transaction::List, Request>(
+        [onTransactions](const Request &request, KAsync::Future<Maniphest::Transaction::List> &future) {
+            streamResponse<Maniphest::Transaction>(request, future, onTransactions);
+        });
 }
@@ -33,6 +33,10 @@ class QDateTime;
 
 #include <QVector>
 
+#include <functional>
+
+#include "phid.h"
+
 namespace Phrary
 {
 
@@ -42,11 +46,77 @@ namespace Maniphest
 {
 
 class Task;
+
+enum TaskOrder {
+    DefaultOrder,
+    OrderByPriority,
+    OrderByCreated,
+    OrderByModified
+};
+
+/**
+ * Priorities of the default Phabricator configuration, with the values
+ * Phabricator uses for them internally.
+ */
+enum TaskPriority {
+    UnknownPriority = -1,
+    WishlistPriority = 0,
+    LowPriority = 25,
+    NormalPriority = 50,
+    HighPriority = 80,
+    NeedsTriagePriority = 90,
+    UnbreakNowPriority = 100
+};
+
+/**
+ * Statuses of the default Phabricator configuration. Custom statuses are
+ * reported as UnknownStatus, use Task::isClosed() to tell whether
+ * such task is still open. Task::statusName() still returns their name.
+ */
+enum TaskStatus {
+    UnknownStatus,
+    OpenStatus,
+    ResolvedStatus,
+    WontfixStatus,
+    InvalidStatus,
+    DuplicateStatus,
+    SpiteStatus
+};
+
+QString priorityName(TaskPriority priority);
+QString priorityColor(TaskPriority priority);
+
+/**
+ * Returns the iCalendar (RFC 5545) priority used for tasks with @p priority
+ * in the Akonadi items, or 0 (undefined) for unknown priorities.
+ */
+int iCalPriority(TaskPriority priority);
+
+QString statusName(TaskStatus status);
+
 KAsync::Job<QVector<Task>, Server> queryTasksByProject(const QString &projectPHID,
-                                                     int offset = 0);
+                                                     int offset = 0,
+                                                     int limit = 0,
+                                                     TaskOrder order = DefaultOrder);
+
+/**
+ * Returns tasks in project @p projectPHID that were modified at or after @p since.
+ *
+ * Conduit cannot filter by modification time, so the tasks are requested from
+ * the most recently modified ones in growing pages until a page reaches a task
+ * older than @p since. When nothing has changed this costs a single small request.
+ * An empty @p projectPHID matches the tasks of all projects.
+ */
+KAsync::Job<QVector<Task>, Server> queryTasksByProjectModifiedSince(const QString &projectPHID,
+                                                                  const QDateTime &since);
 
-KAsync::Job<QVector<Task>, Server> queryTasksByPHID(const QStringList &taskPHIDs,
-                                                  int offset = 0);
+/**
+ * Returns the tasks with the given PHIDs.
+ *
+ * Large lists are split into several requests that are sent concurrently,
+ * the tasks are returned in the order in which the responses arrive.
+ */
+KAsync::Job<QVector<Task>, Server> queryTasksByPHID(const QStringList &taskPHIDs);
 
 class Task
 {
@@ -65,29 +135,33 @@ public:
     uint id() const;
     void setId(uint id);
 
-    QByteArray authorPHID() const;
-    void setAuthorPHID(const QByteArray &author);
+    PhidRef authorPHID() const;
+    void setAuthorPHID(const PhidRef &author);
 
-    QByteArray ownerPHID() const;
-    void setOwnerPHID(const QByteArray &owner);
+    PhidRef ownerPHID() const;
+    void setOwnerPHID(const PhidRef &owner);
 
-    QVector<QByteArray> ccPHIDs() const;
-    void setCcPHIDs(const QVector<QByteArray> &ccPHID);
+    QVector<PhidRef> ccPHIDs() const;
+    void setCcPHIDs(const QVector<PhidRef> &ccPHID);
 
-    QString status() const;
-    void setStatus(const QString &status);
+    TaskStatus status() const;
+    void setStatus(TaskStatus status);
 
+    /**
+     * Name of the status. The name sent by the server is kept only for custom
+     * statuses, for the others it comes from the status().
+     */
     QString statusName() const;
     void setStatusName(const QString &statusName);
 
     bool isClosed() const;
     void setIsClosed(bool isClosed);
 
-    QString priority() const;
-    void setPriority(const QString &priority);
+    TaskPriority priority() const;
+    void setPriority(TaskPriority priority);
 
+    QString priorityName() const;
     QString priorityColor() const;
-    void setPriorityColor(const QString &priorityColor);
 
     QString title() const;
     void setTitle(const QString &title);
@@ -95,8 +169,8 @@ public:
     QString description() const;
     void setDescription(const QString &description);
 
-    QVector<QByteArray> projectPHIDs() const;
-    void setProjectPHIDs(const QVector<QByteArray> &projectPHIDs);
+    QVector<PhidRef> projectPHIDs() const;
+    void setProjectPHIDs(const QVector<PhidRef> &projectPHIDs);
 
     QUrl uri() const;
     void setUri(const QUrl &uri);
@@ -141,8 +215,8 @@ public:
     QString comments() const;
     void setComments(const QString &comments);
 
-    QByteArray authorPHID() const;
-    void setAuthorPHID(const QByteArray &authorPHID);
+    PhidRef authorPHID() const;
+    void setAuthorPHID(const PhidRef &authorPHID);
 
     QDateTime dateCreated() const;
     void setDateCreated(const QDateTime &dateTime);
@@ -159,7 +233,24 @@ private:
 
 KAsync::Job<Transaction::List, Server> queryTransactionsByTask(const QVector<uint> &taskIds);
 
+typedef std::function<void(const Task::List &)> TaskHandler;
+typedef std::function<void(const Transaction::List &)> TransactionHandler;
 
+/**
+ * Same as queryTasksByProject() above, but @p onTasks is called with each task
+ * as soon as it has been received, while the rest of the response is still
+ * being downloaded. The job still finishes with all the tasks.
+ */
+KAsync::Job<Task::List, Server> queryTasksByProject(const QString &projectPHID,
+                                                    int offset, int limit, TaskOrder order,
+                                                    const TaskHandler &onTasks);
+
+/**
+ * Same as queryTransactionsByTask() above, but @p onTransactions is called with
+ * all the transactions of each task as soon as they have been received.
+ */
+KAsync::Job<Transaction::List, Server> queryTransactionsByTask(const QVector<uint> &taskIds,
+                                                               const TransactionHandler &onTransactions);
 
 } // namespace Maniphest
 
@@ -21,27 +21,48 @@
 
 #include "markup.h"
 
-#include <QStack>
-#include <QTextStream>
+#include <QReadWriteLock>
 #include <QString>
-
-#include <QDebug>
+#include <QVarLengthArray>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define MARKUP_SSE2
+#if defined(__AVX2__)
+#define MARKUP_AVX2
+#define AVX2_FUNCTION
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// Not enabled at build time, compiled anyway and used when the CPU has it
+#define MARKUP_AVX2
+#define MARKUP_AVX2_DISPATCH
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+#endif
 
 
 /**
- * This is a very simple, naive and buggy parser for the Phabricator markup syntax.
+ * This is a simple single-pass renderer for the Phabricator markup syntax.
  * It does not support everything and the stuff it supports it supports within
  * certain limits. Certainly not a referencial implementations :-)
  *
- * TODO: proper parser is needed. Maybe we could fork whatever Phabricator uses
- * and port it to C++?
+ * The input is walked exactly once: runs of plain text are copied into the
+ * output in bulk, and only the characters that can start a markup construct
+ * are inspected individually. Block-level constructs (headers, indented and
+ * backquoted monospace) are only recognized at the beginning of a line.
+ *
+ * The renderer must stay linear in the size of the input, task descriptions
+ * with pasted logs can be megabytes long. Any lookahead must either consume
+ * what it scanned or stop at the first character that could start another
+ * instance of the same construct, and text already written to the output
+ * may only be taken back once (see mPlainIn and mLineIn).
+ *
+ * Increase RendererVersion in markup.h with every change of the output.
  *
  * TODO: https://secure.phabricator.com/book/phabricator/article/remarkup/
  * Missing features:
  *      @usermentions
  *      #projectmentions
  *      [[wiki links]]
- *      plain http:// links
  *      > quoted test
  *      - unordered lists
  *      * unordered lists
@@ -58,6 +79,8 @@ namespace Markup {
 
 class Private {
 public:
+    // markupToHTML() is called from many threads at once
+    QReadWriteLock lock;
     QString phabricatorUrl;
 };
 
@@ -70,293 +93,645 @@ using namespace Phrary;
 
 void Markup::setPhabricatorUrl(const QString &url)
 {
+    QWriteLocker locker(&sPrivate->lock);
     sPrivate->phabricatorUrl = url;
 }
 
-static QString htmlTagForMarkupStyle(const QChar &markup)
+QString Markup::phabricatorUrl()
 {
-    if (markup == QLatin1Char('*')) {
-        return QStringLiteral("b");
-    } else if (markup == QLatin1Char('/')) {
-        return QStringLiteral("i");
-    } else if (markup == QLatin1Char('_')) {
-        return QStringLiteral("u");
-    } else if (markup == QLatin1Char('~')) {
-        return QStringLiteral("s");
-    } else if (markup == QLatin1Char('#') || markup == QLatin1Char('`')) {
-        return QStringLiteral("pre");
-    } else {
-        return QString();
+    QReadLocker locker(&sPrivate->lock);
+    return sPrivate->phabricatorUrl;
+}
+
+namespace {
+
+// Characters that may start an inline markup construct, everything else
+// is copied to the output verbatim.
+static const bool SpecialChars[128] = {
+    false, false, false, false, false, false, false, false, false, false, true,  false, false, false, false, false, // \n
+    false, false, false, false, false, false, false, false, false, false, false, false, false, false, false, false,
+    false, false, false, true,  false, false, false, false, false, false, true,  false, false, false, false, true,  // # * /
+    false, false, false, false, false, false, false, false, false, false, true,  false, false, false, false, false, // :
+    false, false, false, false, false, false, false, false, false, false, false, false, false, false, false, false,
+    false, false, false, false, false, false, false, false, false, false, false, true,  false, true,  false, true,  // [ ] _
+    true,  false, false, false, false, false, false, false, false, false, false, false, false, false, false, false, // `
+    false, false, false, false, false, false, false, false, false, false, false, true,  false, false, true,  false  // { ~
+};
+
+static inline bool isSpecial(QChar c)
+{
+    const ushort u = c.unicode();
+    return u < 128 && SpecialChars[u];
+}
+
+#ifdef MARKUP_SSE2
+// The same characters as above, for the vectorized search
+static const char SpecialCharList[] = { '\n', '#', '*', '/', ':', '[', ']', '_', '`', '{', '~' };
+static const int SpecialCount = sizeof(SpecialCharList);
+Q_STATIC_ASSERT(SpecialCount == 11);
+
+static inline __m128i matchSpecials(__m128i chars, const __m128i *specials)
+{
+    // Spelled out, compilers don't unroll loops at -O2
+    const __m128i m0 = _mm_or_si128(_mm_cmpeq_epi8(chars, specials[0]), _mm_cmpeq_epi8(chars, specials[1]));
+    const __m128i m1 = _mm_or_si128(_mm_cmpeq_epi8(chars, specials[2]), _mm_cmpeq_epi8(chars, specials[3]));
+    const __m128i m2 = _mm_or_si128(_mm_cmpeq_epi8(chars, specials[4]), _mm_cmpeq_epi8(chars, specials[5]));
+    const __m128i m3 = _mm_or_si128(_mm_cmpeq_epi8(chars, specials[6]), _mm_cmpeq_epi8(chars, specials[7]));
+    const __m128i m4 = _mm_or_si128(_mm_cmpeq_epi8(chars, specials[8]), _mm_cmpeq_epi8(chars, specials[9]));
+    const __m128i m5 = _mm_cmpeq_epi8(chars, specials[10]);
+    return _mm_or_si128(_mm_or_si128(_mm_or_si128(m0, m1), _mm_or_si128(m2, m3)), _mm_or_si128(m4, m5));
+}
+
+// Skips blocks of 16 plain characters, returns the start of the first block
+// that may contain a special character. The UTF-16 code units are packed to
+// bytes with unsigned saturation first, anything outside of Latin-1 becomes
+// 0 or 255, neither of which is special.
+static inline const QChar *skipPlainSSE2(const QChar *it, const QChar *end)
+{
+    __m128i specials[SpecialCount];
+    for (int i = 0; i < SpecialCount; ++i) {
+        specials[i] = _mm_set1_epi8(SpecialCharList[i]);
     }
+    while (end - it >= 16) {
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it + 8));
+        const __m128i chars = _mm_packus_epi16(lo, hi);
+        if (_mm_movemask_epi8(matchSpecials(chars, specials))) {
+            break;
+        }
+        it += 16;
+    }
+    return it;
 }
+#endif
 
-static bool parseHeader(const QString &text, int &i, QTextStream &outStream, QChar &buff)
+#ifdef MARKUP_AVX2
+AVX2_FUNCTION static inline __m256i matchSpecials(__m256i chars, const __m256i *specials)
 {
-    Q_UNUSED(buff);
+    const __m256i m0 = _mm256_or_si256(_mm256_cmpeq_epi8(chars, specials[0]), _mm256_cmpeq_epi8(chars, specials[1]));
+    const __m256i m1 = _mm256_or_si256(_mm256_cmpeq_epi8(chars, specials[2]), _mm256_cmpeq_epi8(chars, specials[3]));
+    const __m256i m2 = _mm256_or_si256(_mm256_cmpeq_epi8(chars, specials[4]), _mm256_cmpeq_epi8(chars, specials[5]));
+    const __m256i m3 = _mm256_or_si256(_mm256_cmpeq_epi8(chars, specials[6]), _mm256_cmpeq_epi8(chars, specials[7]));
+    const __m256i m4 = _mm256_or_si256(_mm256_cmpeq_epi8(chars, specials[8]), _mm256_cmpeq_epi8(chars, specials[9]));
+    const __m256i m5 = _mm256_cmpeq_epi8(chars, specials[10]);
+    return _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(m0, m1), _mm256_or_si256(m2, m3)), _mm256_or_si256(m4, m5));
+}
 
-    if (i > 0 && text[i - 1] != QLatin1Char('\n')) {
-        return false;
+// Same as skipPlainSSE2(), 32 characters at once, the rest is left to SSE2
+AVX2_FUNCTION static const QChar *skipPlainAVX2(const QChar *it, const QChar *end)
+{
+    __m256i specials[SpecialCount];
+    for (int i = 0; i < SpecialCount; ++i) {
+        specials[i] = _mm256_set1_epi8(SpecialCharList[i]);
     }
+    while (end - it >= 32) {
+        const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(it));
+        const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(it + 16));
+        // packus works within 128-bit lanes, so the characters get shuffled
+        // around, we only need to know whether there's any match though
+        const __m256i chars = _mm256_packus_epi16(lo, hi);
+        if (_mm256_movemask_epi8(matchSpecials(chars, specials))) {
+            break;
+        }
+        it += 32;
+    }
+    return skipPlainSSE2(it, end);
+}
+#endif
 
-    bool isDashes = true;
-    int depth = 0;
-    while (i + depth < text.size() && text[i + depth] == QLatin1Char('-')) {
-        ++depth;
+// Returns the first special character in [it, end), or end. Most of a typical
+// text is plain, so we compare 16 (or 32) characters at once and only fall
+// back to the table lookup for the block that contains a special character.
+static const QChar *findSpecial(const QChar *it, const QChar *end)
+{
+    // In dense markup the special characters are close to each other, check
+    // a few characters one by one before setting up the vectorized search
+    for (const QChar *scalarEnd = it + qMin<qptrdiff>(end - it, 16); it < scalarEnd; ++it) {
+        if (isSpecial(*it)) {
+            return it;
+        }
+    }
+#if defined(MARKUP_AVX2_DISPATCH)
+    static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+    it = hasAVX2 ? skipPlainAVX2(it, end) : skipPlainSSE2(it, end);
+#elif defined(MARKUP_AVX2)
+    it = skipPlainAVX2(it, end);
+#elif defined(MARKUP_SSE2)
+    it = skipPlainSSE2(it, end);
+#endif
+    while (it < end && !isSpecial(*it)) {
+        ++it;
     }
+    return it;
+}
 
-    if (depth == 0) {
-        isDashes = false;
-        while (i + depth < text.size() && text[i + depth] == QLatin1Char('=')) {
+static inline bool isSchemeChar(QChar c)
+{
+    const ushort u = c.unicode();
+    return (u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') || (u >= '0' && u <= '9')
+            || u == '+' || u == '-' || u == '.';
+}
+
+static QLatin1String htmlTagForMarkupStyle(QChar markup)
+{
+    switch (markup.unicode()) {
+    case '*':
+        return QLatin1String("b");
+    case '/':
+        return QLatin1String("i");
+    case '_':
+        return QLatin1String("u");
+    case '~':
+        return QLatin1String("s");
+    default: // '#' and '`'
+        return QLatin1String("pre");
+    }
+}
+
+class Renderer
+{
+public:
+    Renderer(const QString &text, const QString &phabricatorUrl, QString &out)
+        : mText(text.constData())
+        , mSize(text.size())
+        , mPhabricatorUrl(phabricatorUrl)
+        , mOut(out)
+    {
+    }
+
+    void render();
+
+private:
+    bool parseBlock();
+    bool parseHeader();
+    bool parseIndentedPre();
+    bool parseBackquotePre();
+
+    void parseStyle(QChar c);
+    void parseLinkStart();
+    void parseLinkEnd();
+    void parseReference();
+    void parsePlainLink();
+
+    void startLine();
+    int endOfLine(int from) const;
+
+    void appendText(int from, int count);
+    void appendMarkup(QLatin1String markup);
+    void appendMarkup(const QString &markup);
+    void appendTag(QLatin1String tag, bool closing);
+    void appendHeader(int level, int from, int to);
+    void appendLink(int from, int to);
+    void flushPending();
+
+    const QChar *mText;
+    const int mSize;
+    const QString mPhabricatorUrl;
+    QString &mOut;
+    int mPos = 0;
+
+    // A single markup character waiting to see whether it is followed by
+    // its pair ("**", "[[", ...) or whether it's just a plain character.
+    int mPending = -1;
+
+    // The output in [mPlainOut, mOut.size()) is a verbatim copy of the input
+    // starting at mPlainIn, so that text can be rewritten once we find out it
+    // was part of a link or a header.
+    int mPlainIn = -1;
+    int mPlainOut = 0;
+
+    // Where the current line started, or -1 when it was consumed by a block
+    int mLineIn = -1;
+    int mLineOut = 0;
+    bool mLineHasMarkup = false;
+
+    bool mInLink = false;
+    bool mLinkHasAnchor = false;
+    QVarLengthArray<QChar, 16> mStyleStack;
+};
 
-            ++depth;
+void Renderer::render()
+{
+    while (mPos < mSize) {
+        if (mPos == 0 || mText[mPos - 1] == QLatin1Char('\n')) {
+            if (parseBlock()) {
+                continue;
+            }
+            startLine();
+        }
+
+        // Copy everything up to the next markup character in one go
+        const int end = findSpecial(mText + mPos, mText + mSize) - mText;
+        if (end > mPos) {
+            flushPending();
+            appendText(mPos, end - mPos);
+            mPos = end;
+            if (mPos == mSize) {
+                break;
+            }
         }
+
+        const QChar c = mText[mPos];
+        switch (c.unicode()) {
+        case '\n':
+            flushPending();
+            mOut.append(QLatin1String("<br>"));
+            mPlainIn = -1;
+            ++mPos;
+            break;
+        case '*':
+        case '/':
+        case '#':
+        case '~':
+        case '_':
+        case '`':
+            parseStyle(c);
+            break;
+        case '[':
+            parseLinkStart();
+            break;
+        case ']':
+            parseLinkEnd();
+            break;
+        case '{':
+            parseReference();
+            break;
+        case ':':
+            parsePlainLink();
+            break;
+        }
+    }
+
+    flushPending();
+    if (mInLink && mLinkHasAnchor) {
+        appendMarkup(QLatin1String("</a>"));
+    }
+    while (!mStyleStack.isEmpty()) {
+        appendTag(htmlTagForMarkupStyle(mStyleStack.last()), true);
+        mStyleStack.removeLast();
     }
-    if (depth == 0) {
+}
+
+void Renderer::startLine()
+{
+    mLineIn = mPos;
+    mLineOut = mOut.size();
+    mLineHasMarkup = false;
+}
+
+int Renderer::endOfLine(int from) const
+{
+    while (from < mSize && mText[from] != QLatin1Char('\n')) {
+        ++from;
+    }
+    return from;
+}
+
+bool Renderer::parseBlock()
+{
+    switch (mText[mPos].unicode()) {
+    case '=':
+    case '-':
+        return parseHeader();
+    case ' ':
+        return parseIndentedPre();
+    case '`':
+        return parseBackquotePre();
+    default:
         return false;
     }
+}
 
-    int eol = text.indexOf(QLatin1Char('\n'), i + depth); // trailing "=" are optional
-    if (eol == -1) {
-        eol = text.size();
+bool Renderer::parseHeader()
+{
+    const QChar marker = mText[mPos];
+    int depth = 0;
+    while (mPos + depth < mSize && mText[mPos + depth] == marker) {
+        ++depth;
     }
 
-    // if the "===" span over the entire line, assume "Blabla\n======" format
-    if (eol == i + depth) {
-        if (i < depth + 1) {
+    const int eol = endOfLine(mPos + depth);
+    if (eol == mPos + depth) {
+        // The "===" span over the entire line, assume "Blabla\n======" format,
+        // unless the previous line was already rendered into something else
+        // than plain text
+        if (mLineIn == -1 || mLineHasMarkup) {
             return false;
         }
-
-        const int realDepth = (text[i] == QLatin1Char('-')) ? 2 : 1;
-        int prevEol = qMax(text.lastIndexOf(QLatin1Char('\n'), i - 2), 0);
-        const QString header = text.midRef(prevEol, i - 1 - prevEol).trimmed().toString();
-        // Dirty trick: outStream.seek() does not work, we need to trim the actual string
-        // Removes the header data written by previous parsers because they did not know
-        // this is a header.
-        outStream.string()->resize(outStream.pos() - header.size());
-        outStream << QStringLiteral("<h%1>%2</h%1>").arg(realDepth).arg(header);
-        i += depth;
-    } else if (!isDashes) {
-        i += depth;
-        int end = text.indexOf(QLatin1Char('='), i);
-        if (end == -1) {
-            end = eol;
+        int from = mLineIn;
+        int to = mPos - 1;
+        while (from < to && mText[from].isSpace()) {
+            ++from;
         }
-        const QString header = text.midRef(i, qMin(end, eol) - i).trimmed().toString();
-        if (depth > 0) {
-            outStream << QStringLiteral("<h%1>%2</h%1>").arg(depth).arg(header);
+        while (to > from && mText[to - 1].isSpace()) {
+            --to;
+        }
+        if (from == to) {
+            return false;
         }
 
-        // Read until end of line
-        for (; i < text.size() - 1 && text[i + 1] != QLatin1Char('\n'); ++i);
-    } else if (isDashes) {
+        // Replace the already rendered line with the header
+        mOut.truncate(mLineOut);
+        appendHeader(marker == QLatin1Char('-') ? 2 : 1, from, to);
+        mPos = qMin(eol + 1, mSize);
+    } else if (marker == QLatin1Char('=')) {
+        int from = mPos + depth;
+        int to = from;
+        while (to < eol && mText[to] != QLatin1Char('=')) { // trailing "=" are optional
+            ++to;
+        }
+        while (from < to && mText[from].isSpace()) {
+            ++from;
+        }
+        while (to > from && mText[to - 1].isSpace()) {
+            --to;
+        }
+        appendHeader(depth, from, to);
+        mPos = eol;
+    } else {
         return false;
     }
 
+    mLineIn = -1;
     return true;
 }
 
-static bool parseIndentedPre(const QString &text, int &i, QTextStream &outStream)
+bool Renderer::parseIndentedPre()
 {
     static const int MinIndent = 2;
 
-    if (i > 0 && text[i - 1] != QLatin1Char('\n')) {
-        return false;
-    }
-
     bool isFirstLine = true;
     Q_FOREVER {
-        for (int j = 0; j < MinIndent; j++) {
-            if (text.size() <= i + j || text[i + j] != QLatin1Char(' ')) {
-                if (!isFirstLine) {
-                    outStream << QStringLiteral("</pre>");
-                    if (text.size() > i + j) {
-                        outStream << QStringLiteral("<br>");
-                    }
-                }
-                return !isFirstLine;
-            }
+        if (mPos + MinIndent > mSize || mText[mPos] != QLatin1Char(' ') || mText[mPos + 1] != QLatin1Char(' ')) {
+            break;
         }
 
-        i += MinIndent;
+        mPos += MinIndent;
         if (isFirstLine) {
-            outStream << QStringLiteral("<pre>");
+            appendMarkup(QLatin1String("<pre>"));
             isFirstLine = false;
         }
 
-        int eol = text.indexOf(QLatin1Char('\n'), i);
-        if (eol == -1) {
-            eol = text.size() - 1;
-        }
+        const int eol = qMin(endOfLine(mPos) + 1, mSize);
+        appendText(mPos, eol - mPos);
+        mPos = eol;
+    }
 
-        outStream << text.mid(i, eol - i + 1);
-        i = eol + 1;
+    if (isFirstLine) {
+        return false;
     }
 
-    return false;
+    appendMarkup(QLatin1String("</pre>"));
+    mLineIn = -1;
+    return true;
 }
 
-static bool parseBackquotePre(const QString &text, int &i, QTextStream &outStream)
+bool Renderer::parseBackquotePre()
 {
-    if (i > 0 && text[i - 1] != QLatin1Char('\n')) {
-        return false;
-    }
-
-    if (text.mid(i, 3) != QLatin1String("```")) {
+    if (mPos + 3 > mSize || mText[mPos + 1] != QLatin1Char('`') || mText[mPos + 2] != QLatin1Char('`')) {
         return false;
     }
 
-    outStream << QStringLiteral("<pre>");
-    i += 4; // read past ```\n
+    appendMarkup(QLatin1String("<pre>"));
+    // read past the ``` line
+    const int start = qMin(endOfLine(mPos + 3) + 1, mSize);
 
-    int end = text.indexOf(QStringLiteral("```"), i);
-    if (end == -1) {
-        end = text.size();
+    int end = start;
+    while (end + 3 <= mSize && !(mText[end] == QLatin1Char('`') && mText[end + 1] == QLatin1Char('`')
+                                 && mText[end + 2] == QLatin1Char('`'))) {
+        ++end;
+    }
+    if (end + 3 > mSize) {
+        end = mSize;
     }
 
-    outStream << text.mid(i, end - i);
-    outStream << QStringLiteral("</pre>");
+    appendText(start, end - start);
+    appendMarkup(QLatin1String("</pre>"));
     // skip the backticks
-    i = end + 2;
-
+    mPos = qMin(end + 3, mSize);
+    mLineIn = -1;
     return true;
 }
 
+void Renderer::parseStyle(QChar c)
+{
+    if (c != QLatin1Char('`')) {
+        if (mPending == -1 || mText[mPending] != c) {
+            flushPending();
+            mPending = mPos++;
+            return;
+        }
+        mPending = -1;
+    } else {
+        flushPending();
+    }
 
-QString Phrary::Markup::markupToHTML(const QString &text)
+    if (!mStyleStack.isEmpty() && mStyleStack.last() == c) {
+        mStyleStack.removeLast();
+        appendTag(htmlTagForMarkupStyle(c), true);
+    } else {
+        mStyleStack.append(c);
+        appendTag(htmlTagForMarkupStyle(c), false);
+    }
+    ++mPos;
+}
+
+void Renderer::parseLinkStart()
 {
-    struct MarkupMap {
-        char markup;
-        char html;
-    };
+    if (mPending == -1 || mText[mPending] != QLatin1Char('[') || mInLink) {
+        flushPending();
+        mPending = mPos++;
+        return;
+    }
 
-    QString out;
-    out.reserve(text.size()); // reserve at least text.size() characters
-    QTextStream outStream(&out, QIODevice::ReadWrite);
-
-    QChar c;
-    QChar prev;
-    QChar buff;
-    QStack<QChar> styleStack;
-    for (int i = 0; i < text.size(); ++i) {
-        c = text[i];
-        if (parseHeader(text, i, outStream, buff)) {
-            prev = c;
-            continue;
-        } else if (parseIndentedPre(text, i, outStream)) {
-            prev = c;
-            continue;
-        } else if (parseBackquotePre(text, i, outStream)) {
-            prev = c;
-            continue;
-        } else if (text.mid(i, 3) == QStringLiteral("://")) {
-            int linkStart = i;
-            while (linkStart > 0 && !text[linkStart].isSpace() && text[linkStart] != QLatin1Char('\n')) {
-                --linkStart;
-            }
-            int linkEnd = i;
-            while (linkEnd < text.size() && !text[linkEnd].isSpace() && text[linkEnd] != QLatin1Char('\n')) {
-                ++linkEnd;
-            }
-            outStream.string()->resize(outStream.string()->size() - (i - linkStart) + 1);
-            const QString link = text.mid(linkStart + 1, linkEnd - linkStart - 1);
-            outStream << QStringLiteral("<a href=\"%1\">%1</a>").arg(link);
-            i = linkEnd - 1;
-        } else if (c == QLatin1Char('`')) {
-            if (!styleStack.isEmpty() && styleStack.top() == c) {
-                styleStack.pop();
-                outStream << QStringLiteral("</pre>");
-            } else {
-                styleStack.push(c);
-                outStream << QStringLiteral("<pre>");
-            }
-            c = QLatin1Char('>');
-        } else if  (c == QLatin1Char('*') || c == QLatin1Char('/') || c == QLatin1Char('#') || c == QLatin1Char('~') || c == QLatin1Char('_')) {
-            if (c == prev) {
-                buff = 0;
-                if (!styleStack.isEmpty() && styleStack.top() == c) {
-                    styleStack.pop();
-                    outStream << QStringLiteral("</%1>").arg(htmlTagForMarkupStyle(c));
-                } else {
-                    styleStack.push(c);
-                    outStream << QStringLiteral("<%1>").arg(htmlTagForMarkupStyle(c));
-                }
-                c = QLatin1Char('>');
-            } else {
-                buff = c;
-            }
-        } else if (c == QLatin1Char('[')) {
-            if (c == prev) {
-                buff = 0;
-                int start = -1, end = -1;
-                for (; i < text.size(); ++i) {
-                    if (text[i] == QLatin1Char('|')) {
-                        end = i;
-                        break;
-                    } else if (!text[i].isSpace() && start == -1) {
-                        start = i + 1;
-                    } else if (end == -1 && start > -1 && text[i] == QLatin1Char(' ')) {
-                        end = i;
-                    }
-                }
-                const QString url = text.mid(start, end - start).trimmed();
-                if (url.startsWith(QLatin1String("http"))) {
-                    outStream << QStringLiteral("<a href=\"%1\">").arg(url);
-                }
-                c = QLatin1Char('>');
-            } else {
-                buff = c;
-            }
-        } else if (c == QLatin1Char(']')) {
-            if (c == prev) {
-                buff = 0;
-                outStream << QStringLiteral("</a>");
-                c = QLatin1Char('>');
-            } else {
-                buff = c;
-            }
-        } else if (c == QLatin1Char('{') && (text[i + 1] == QLatin1Char('F') || text[i + 1] == QLatin1Char('T') || text[i + 1] == QLatin1Char('D'))) {
-            const int end = text.indexOf(QLatin1Char('}'), i);
-            if (end == -1) {
-                buff = c;
-                continue;
-            }
-            // Spaces in { } are not allowed
-            if (text.indexOf(QLatin1Char(' '), i) < end) {
-                buff = c;
-                continue;
-            }
-            bool ok = false;
-            text.mid(i + 2, end - i - 2).toInt(&ok);
-            if (!ok) {
-                buff = c;
-                continue;
-            }
+    // [[ url | text ]] or [[ url ]]
+    int urlStart = mPos + 1;
+    while (urlStart < mSize && mText[urlStart] == QLatin1Char(' ')) {
+        ++urlStart;
+    }
+    int urlEnd = urlStart;
+    while (urlEnd < mSize && !mText[urlEnd].isSpace() && mText[urlEnd] != QLatin1Char('|')
+            && mText[urlEnd] != QLatin1Char(']') && mText[urlEnd] != QLatin1Char('[')) {
+        ++urlEnd;
+    }
+    int next = urlEnd;
+    while (next < mSize && mText[next] == QLatin1Char(' ')) {
+        ++next;
+    }
 
-            outStream << QStringLiteral("<a href=\"%1/%2\">%1/%2</a>").arg(sPrivate->phabricatorUrl, text.mid(i + 1, end - i - 1));
-            i = end;
+    const bool isHttp = urlEnd - urlStart >= 4 && mText[urlStart] == QLatin1Char('h')
+                        && mText[urlStart + 1] == QLatin1Char('t') && mText[urlStart + 2] == QLatin1Char('t')
+                        && mText[urlStart + 3] == QLatin1Char('p');
+    if (urlEnd > urlStart && next < mSize && mText[next] == QLatin1Char('|')) {
+        mPending = -1;
+        if (isHttp) {
+            appendMarkup(QLatin1String("<a href=\""));
+            appendText(urlStart, urlEnd - urlStart);
+            appendMarkup(QLatin1String("\">"));
+        }
+        mInLink = true;
+        mLinkHasAnchor = isHttp;
+        mLineHasMarkup = true;
+        mPos = next + 1;
+    } else if (urlEnd > urlStart && next + 1 < mSize && mText[next] == QLatin1Char(']')
+               && mText[next + 1] == QLatin1Char(']')) {
+        mPending = -1;
+        if (isHttp) {
+            appendLink(urlStart, urlEnd);
         } else {
-            if (!buff.isNull()) {
-                if (buff == QLatin1Char('\n')) {
-                    outStream << QStringLiteral("<br>");
-                } else {
-                    outStream << buff;
-                }
-                buff = 0;
-            }
-            if (c == QLatin1Char('\n')) {
-                outStream << QStringLiteral("<br>");
-            } else {
-                outStream << c;
+            appendText(urlStart, urlEnd - urlStart);
+        }
+        mPos = next + 2;
+    } else {
+        // Not a link after all
+        flushPending();
+        appendText(mPos++, 1);
+    }
+}
+
+void Renderer::parseLinkEnd()
+{
+    if (mPending == -1 || mText[mPending] != QLatin1Char(']') || !mInLink) {
+        flushPending();
+        mPending = mPos++;
+        return;
+    }
+
+    mPending = -1;
+    if (mLinkHasAnchor) {
+        appendMarkup(QLatin1String("</a>"));
+    }
+    mInLink = false;
+    mLineHasMarkup = true;
+    ++mPos;
+}
+
+void Renderer::parseReference()
+{
+    flushPending();
+
+    // {T123}, {D123} or {F123}
+    int end = mPos + 1;
+    if (end < mSize && (mText[end] == QLatin1Char('F') || mText[end] == QLatin1Char('T')
+                        || mText[end] == QLatin1Char('D'))) {
+        ++end;
+        while (end < mSize && mText[end].unicode() >= '0' && mText[end].unicode() <= '9') {
+            ++end;
+        }
+        if (end > mPos + 2 && end < mSize && mText[end] == QLatin1Char('}')) {
+            const QString &url = mPhabricatorUrl;
+            appendMarkup(QLatin1String("<a href=\""));
+            appendMarkup(url);
+            appendMarkup(QLatin1String("/"));
+            appendText(mPos + 1, end - mPos - 1);
+            appendMarkup(QLatin1String("\">"));
+            appendMarkup(url);
+            appendMarkup(QLatin1String("/"));
+            appendText(mPos + 1, end - mPos - 1);
+            appendMarkup(QLatin1String("</a>"));
+            mPos = end + 1;
+            return;
+        }
+    }
+
+    appendText(mPos++, 1);
+}
+
+void Renderer::parsePlainLink()
+{
+    flushPending();
+
+    if (!mInLink && mPos + 2 < mSize && mText[mPos + 1] == QLatin1Char('/') && mText[mPos + 2] == QLatin1Char('/')) {
+        // Find the scheme in the text we have just copied to the output
+        int start = mPos;
+        while (mPlainIn > -1 && start > mPlainIn && isSchemeChar(mText[start - 1])) {
+            --start;
+        }
+        if (start < mPos) {
+            int end = mPos + 3;
+            while (end < mSize && !mText[end].isSpace()) {
+                ++end;
             }
+            mOut.truncate(mPlainOut + (start - mPlainIn));
+            appendLink(start, end);
+            mPos = end;
+            return;
         }
+    }
+
+    appendText(mPos++, 1);
+}
 
-        prev = c;
+void Renderer::flushPending()
+{
+    if (mPending > -1) {
+        appendText(mPending, 1);
+        mPending = -1;
     }
+}
 
-    if (!buff.isNull()) {
-        outStream << buff;
+void Renderer::appendText(int from, int count)
+{
+    if (mPlainIn == -1 || mPlainIn + (mOut.size() - mPlainOut) != from) {
+        mPlainIn = from;
+        mPlainOut = mOut.size();
     }
+    mOut.append(mText + from, count);
+}
 
-    return out;
+void Renderer::appendMarkup(QLatin1String markup)
+{
+    mOut.append(markup);
+    mPlainIn = -1;
+    mLineHasMarkup = true;
 }
 
+void Renderer::appendMarkup(const QString &markup)
+{
+    mOut.append(markup);
+    mPlainIn = -1;
+    mLineHasMarkup = true;
+}
+
+void Renderer::appendTag(QLatin1String tag, bool closing)
+{
+    appendMarkup(closing ? QLatin1String("</") : QLatin1String("<"));
+    appendMarkup(tag);
+    appendMarkup(QLatin1String(">"));
+}
+
+void Renderer::appendHeader(int level, int from, int to)
+{
+    const QChar levelChar = QLatin1Char('0' + qBound(1, level, 6));
+    appendMarkup(QLatin1String("<h"));
+    mOut.append(levelChar);
+    appendMarkup(QLatin1String(">"));
+    appendText(from, to - from);
+    appendMarkup(QLatin1String("</h"));
+    mOut.append(levelChar);
+    appendMarkup(QLatin1String(">"));
+}
+
+void Renderer::appendLink(int from, int to)
+{
+    appendMarkup(QLatin1String("<a href=\""));
+    appendText(from, to - from);
+    appendMarkup(QLatin1String("\">"));
+    appendText(from, to - from);
+    appendMarkup(QLatin1String("</a>"));
+}
+
+}
+
+QString Phrary::Markup::markupToHTML(const QString &text)
+{
+    QString out;
+    // Reserve some extra space for the tags, so that we don't have to
+    // reallocate for every couple of them
+    out.reserve(text.size() + text.size() / 8 + 32);
+
+    Renderer renderer(text, Markup::phabricatorUrl(), out);
+    renderer.render();
+
+    return out;
+}
@@ -29,7 +29,15 @@ namespace Phrary {
 namespace Markup
 {
 
+/**
+ * Version of the HTML produced by markupToHTML(). Must be increased whenever
+ * the output for some input changes, so that HTML rendered and stored by an
+ * older version is not reused.
+ */
+const int RendererVersion = 1;
+
 void setPhabricatorUrl(const QString &url);
+QString phabricatorUrl();
 
 QString markupToHTML(const QString &text);
 
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "phid.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <QReadWriteLock>
+#include <QVector>
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+using namespace Phrary;
+
+struct Phrary::PhidEntry
+{
+    int size;
+    char data[1];
+};
+
+namespace {
+
+/**
+ * Never freed storage of the interned PHIDs. Each PHID is copied once into
+ * a large block and looked up through a hash keyed by raw data pointing to
+ * that same copy.
+ */
+class PhidPool
+{
+public:
+    PhidPool()
+        : mBlockPos(Q_NULLPTR)
+        , mBlockFree(0)
+    {
+    }
+
+    const PhidEntry *intern(const char *phid, int size)
+    {
+        const QByteArray key = QByteArray::fromRawData(phid, size);
+        {
+            QReadLocker locker(&mLock);
+            const auto it = mTable.constFind(key);
+            if (it != mTable.cend()) {
+                return it.value();
+            }
+        }
+
+        QWriteLocker locker(&mLock);
+        // Someone else might have inserted it in the meantime
+        const auto it = mTable.constFind(key);
+        if (it != mTable.cend()) {
+            return it.value();
+        }
+
+        PhidEntry *entry = reinterpret_cast<PhidEntry*>(allocate(static_cast<int>(offsetof(PhidEntry, data)) + size + 1));
+        entry->size = size;
+        memcpy(entry->data, phid, size);
+        entry->data[size] = '\0';
+        mTable.insert(QByteArray::fromRawData(entry->data, size), entry);
+        return entry;
+    }
+
+    int size()
+    {
+        QReadLocker locker(&mLock);
+        return mTable.size();
+    }
+
+private:
+    char *allocate(int size)
+    {
+        static const int BlockSize = 64 * 1024;
+        static const int Alignment = alignof(PhidEntry);
+
+        // Keep the entries aligned for their size member
+        size = (size + Alignment - 1) & ~(Alignment - 1);
+        if (size > BlockSize / 4) {
+            return static_cast<char*>(malloc(size));
+        }
+        if (size > mBlockFree) {
+            mBlockPos = static_cast<char*>(malloc(BlockSize));
+            mBlockFree = BlockSize;
+        }
+        char *entry = mBlockPos;
+        mBlockPos += size;
+        mBlockFree -= size;
+        return entry;
+    }
+
+    QReadWriteLock mLock;
+    QHash<QByteArray, const PhidEntry*> mTable;
+    char *mBlockPos;
+    int mBlockFree;
+};
+
+}
+
+Q_GLOBAL_STATIC(PhidPool, sPool)
+
+PhidRef::PhidRef(const QByteArray &phid)
+    : d(phid.isEmpty() ? Q_NULLPTR : sPool->intern(phid.constData(), phid.size()))
+{
+}
+
+PhidRef::PhidRef(const char *phid, int size)
+    : d(size <= 0 ? Q_NULLPTR : sPool->intern(phid, size))
+{
+}
+
+const char *PhidRef::constData() const
+{
+    return d ? d->data : "";
+}
+
+int PhidRef::size() const
+{
+    return d ? d->size : 0;
+}
+
+QByteArray PhidRef::toByteArray() const
+{
+    return d ? QByteArray::fromRawData(d->data, d->size) : QByteArray();
+}
+
+QString PhidRef::toString() const
+{
+    return d ? QString::fromLatin1(d->data, d->size) : QString();
+}
+
+int PhidRef::poolSize()
+{
+    return sPool->size();
+}
+
+QDataStream &Phrary::operator<<(QDataStream &stream, const PhidRef &phid)
+{
+    return stream << phid.toByteArray();
+}
+
+QDataStream &Phrary::operator>>(QDataStream &stream, PhidRef &phid)
+{
+    QByteArray data;
+    stream >> data;
+    phid = PhidRef(data);
+    return stream;
+}
+
+QDebug Phrary::operator<<(QDebug dbg, const PhidRef &phid)
+{
+    QDebugStateSaver saver(dbg);
+    dbg.nospace() << "PhidRef(" << phid.constData() << ")";
+    return dbg;
+}
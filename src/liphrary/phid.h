@@ -0,0 +1,114 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PHRARY_PHID_H
+#define PHRARY_PHID_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMetaType>
+#include <QString>
+
+class QDataStream;
+class QDebug;
+
+namespace Phrary
+{
+
+struct PhidEntry;
+
+/**
+ * Handle to a PHID in the process-wide PHID pool.
+ *
+ * The same user and project PHIDs appear in thousands of tasks and
+ * transactions, so each distinct PHID is stored only once and everyone
+ * else holds a pointer to it. Comparing and hashing PhidRefs compares
+ * pointers, not strings.
+ *
+ * PHIDs are never removed from the pool, so the handles never dangle. Only
+ * user and project PHIDs are interned, there's a limited number of them on
+ * any Phabricator instance. Task PHIDs are plain QByteArrays, they would make
+ * the pool grow with every task ever synced. Interning is thread-safe.
+ */
+class PhidRef
+{
+public:
+    PhidRef()
+        : d(Q_NULLPTR)
+    {
+    }
+
+    /**
+     * Interns @p phid. An empty @p phid results in an empty PhidRef.
+     */
+    explicit PhidRef(const QByteArray &phid);
+    PhidRef(const char *phid, int size);
+
+    bool isEmpty() const
+    {
+        return d == Q_NULLPTR;
+    }
+
+    const char *constData() const;
+    int size() const;
+
+    /**
+     * Returns the PHID without copying it.
+     */
+    QByteArray toByteArray() const;
+    QString toString() const;
+
+    bool operator==(const PhidRef &other) const
+    {
+        return d == other.d;
+    }
+
+    bool operator!=(const PhidRef &other) const
+    {
+        return d != other.d;
+    }
+
+    /**
+     * Number of distinct PHIDs in the pool.
+     */
+    static int poolSize();
+
+private:
+    const PhidEntry *d;
+
+    friend uint qHash(const PhidRef &phid, uint seed);
+};
+
+inline uint qHash(const PhidRef &phid, uint seed = 0)
+{
+    return qHash(reinterpret_cast<quintptr>(phid.d), seed);
+}
+
+QDataStream &operator<<(QDataStream &stream, const PhidRef &phid);
+QDataStream &operator>>(QDataStream &stream, PhidRef &phid);
+QDebug operator<<(QDebug dbg, const PhidRef &phid);
+
+}
+
+Q_DECLARE_TYPEINFO(Phrary::PhidRef, Q_PRIMITIVE_TYPE);
+Q_DECLARE_METATYPE(Phrary::PhidRef)
+
+#endif // PHRARY_PHID_H
@@ -22,16 +22,14 @@
 #include "project.h"
 #include "server.h"
 #include "utils_p.h"
+#include "jsonreader_p.h"
 
 #include <QDateTime>
-#include <QVariantMap>
+#include <QStringList>
 #include <QByteArray>
 #include <QUrl>
-#include <QUrlQuery>
-
-#include <QJsonDocument>
-
-#include <KIO/StoredTransferJob>
+#include <QJsonArray>
+#include <QJsonObject>
 
 using namespace Phrary;
 
@@ -59,45 +57,65 @@ public:
     {
     }
 
-    static Project::List parse(const QVariant &result)
+    /**
+     * Parses the "data" member of the project.query result, other members
+     * of the result are skipped.
+     */
+    static void parseElement(const QByteArray &name, JsonReader &reader, Project::List &projects)
     {
-        const QVariantMap &data = result.toMap()[QStringLiteral("data")].toMap();
+        if (name != "data") {
+            reader.skipValue();
+            return;
+        }
+        if (!reader.enterObject()) {
+            return;
+        }
 
-        Project::List projects;
-        projects.reserve(data.size());
+        QByteArray phid, key;
+        while (reader.nextKey(phid)) {
+            if (!reader.enterObject()) {
+                continue;
+            }
 
-        for (auto iter = data.cbegin(), end = data.cend(); iter != end; ++iter) {
-            const QVariantMap d = iter.value().toMap();
             Project project;
-            project.d_ptr->phid = iter.key().toLatin1();
-            project.d_ptr->id = d[QStringLiteral("id")].toInt();
-            project.d_ptr->phid = d[QStringLiteral("phid")].toByteArray();
-            project.d_ptr->name = d[QStringLiteral("name")].toString();
-            project.d_ptr->profileImagePHID = d[QStringLiteral("profileImagePHID")].toByteArray();
-            project.d_ptr->icon = d[QStringLiteral("icon")].toString();
-            project.d_ptr->color = d[QStringLiteral("color")].toString();
-            const QVariantList memberPHIDs = d[QStringLiteral("members")].toList();
-            project.d_ptr->memberPHIDs.reserve(memberPHIDs.size());
-            Q_FOREACH (const QVariant &memberPHID, memberPHIDs) {
-                project.d_ptr->memberPHIDs.push_back(memberPHID.toByteArray());
+            project.d_ptr->phid = PhidRef(phid);
+            while (reader.nextKey(key)) {
+                if (key == "id") {
+                    project.d_ptr->id = static_cast<uint>(reader.readInt());
+                } else if (key == "phid") {
+                    project.d_ptr->phid = reader.readPhid();
+                } else if (key == "name") {
+                    project.d_ptr->name = reader.readString();
+                } else if (key == "profileImagePHID") {
+                    project.d_ptr->profileImagePHID = reader.readUtf8();
+                } else if (key == "icon") {
+                    project.d_ptr->icon = reader.readString();
+                } else if (key == "color") {
+                    project.d_ptr->color = reader.readString();
+                } else if (key == "members") {
+                    project.d_ptr->memberPHIDs = reader.readPhidList();
+                } else if (key == "slugs") {
+                    project.d_ptr->slugs = reader.readStringList();
+                } else if (key == "dateCreated") {
+                    project.d_ptr->dateCreated = QDateTime::fromTime_t(static_cast<uint>(reader.readInt()));
+                } else if (key == "dateModified") {
+                    project.d_ptr->dateModified = QDateTime::fromTime_t(static_cast<uint>(reader.readInt()));
+                } else {
+                    reader.skipValue();
+                }
             }
-            project.d_ptr->slugs = d[QStringLiteral("slugs")].toStringList();
-            project.d_ptr->dateCreated = QDateTime::fromTime_t(d[QStringLiteral("dateCreated")].toUInt());
-            project.d_ptr->dateModified = QDateTime::fromTime_t(d[QStringLiteral("dateModified")].toUInt());
 
             projects.push_back(project);
         }
-
-        return projects;
     }
 
-    QByteArray phid;
+    PhidRef phid;
     uint id;
     QString name;
     QByteArray profileImagePHID;
     QString icon;
     QString color;
-    QVector<QByteArray> memberPHIDs;
+    QVector<PhidRef> memberPHIDs;
     QStringList slugs;
     QDateTime dateCreated;
     QDateTime dateModified;
@@ -119,29 +137,22 @@ Project::~Project()
 
 KAsync::Job<Project::List, Server> Project::query(const QStringList &phids)
 {
-    return KAsync::start<QUrl, Server>(
+    return KAsync::start<Request, Server>(
         [phids](const Server &server) {
-            QUrlQuery query;
-            query.addQueryItem(QStringLiteral("api.token"), server.apiToken());
-            for (int i = 0; i < phids.count(); ++i) {
-                query.addQueryItem(QStringLiteral("phids[%1]").arg(i),
-                                   phids.at(i));
-            }
+            QJsonObject params;
+            params[QStringLiteral("phids")] = QJsonArray::fromStringList(phids);
 
-            QUrl url(server.server());
-            url.setPath(QStringLiteral("/api/project.query"));
-            url.setQuery(query);
-            return url;
+            return Request{ server, QStringLiteral("project.query"), params };
         })
-    .then<Project::List, QUrl>(&Phrary::parseResponse<Project>);
+    .then<Project::List, Request>(&Phrary::parseResponse<Project>);
 }
 
-QByteArray Project::phid() const
+PhidRef Project::phid() const
 {
     return d_ptr->phid;
 }
 
-void Project::setPHID(const QByteArray &phid)
+void Project::setPHID(const PhidRef &phid)
 {
     d_ptr->phid = phid;
 }
@@ -196,12 +207,12 @@ void Project::setColor(const QString &color)
     d_ptr->color = color;
 }
 
-QVector<QByteArray> Project::memberPHIDs() const
+QVector<PhidRef> Project::memberPHIDs() const
 {
     return d_ptr->memberPHIDs;
 }
 
-void Project::setMemberPHIDs(const QVector<QByteArray> &memberPHIDs)
+void Project::setMemberPHIDs(const QVector<PhidRef> &memberPHIDs)
 {
     d_ptr->memberPHIDs = memberPHIDs;
 }
@@ -24,6 +24,8 @@
 
 #include <Async>
 
+#include "phid.h"
+
 #include <QVector>
 #include <QSharedDataPointer>
 
@@ -49,8 +51,8 @@ public:
 
     static KAsync::Job<Project::List, Server> query(const QStringList &projectPHIDs = QStringList());
 
-    QByteArray phid() const;
-    void setPHID(const QByteArray &phid);
+    PhidRef phid() const;
+    void setPHID(const PhidRef &phid);
 
     uint id() const;
     void setId(uint id);
@@ -67,8 +69,8 @@ public:
     QString color() const;
     void setColor(const QString &color);
 
-    QVector<QByteArray> memberPHIDs() const;
-    void setMemberPHIDs(const QVector<QByteArray> &memberPHIDs);
+    QVector<PhidRef> memberPHIDs() const;
+    void setMemberPHIDs(const QVector<PhidRef> &memberPHIDs);
 
     QStringList slugs() const;
     void setSlugs(const QStringList &slugs);
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "requestscheduler.h"
+
+#include <QPointer>
+#include <QQueue>
+#include <QSharedPointer>
+
+using namespace Phrary;
+
+class RequestScheduler::Private
+{
+public:
+    Private()
+        : maxParallelRequests(4)
+        , activeRequests(0)
+    {
+    }
+
+    static const int PriorityCount = LowPriority + 1;
+
+    QQueue<Runnable> queues[PriorityCount];
+    int maxParallelRequests;
+    int activeRequests;
+};
+
+RequestScheduler::RequestScheduler(QObject *parent)
+    : QObject(parent)
+    , d_ptr(new Private)
+{
+}
+
+RequestScheduler::~RequestScheduler()
+{
+}
+
+void RequestScheduler::setMaxParallelRequests(int maxParallelRequests)
+{
+    d_ptr->maxParallelRequests = qMax(1, maxParallelRequests);
+    startNextRequest();
+}
+
+int RequestScheduler::maxParallelRequests() const
+{
+    return d_ptr->maxParallelRequests;
+}
+
+int RequestScheduler::queueDepth() const
+{
+    int depth = 0;
+    for (const auto &queue : d_ptr->queues) {
+        depth += queue.size();
+    }
+    return depth;
+}
+
+int RequestScheduler::activeRequests() const
+{
+    return d_ptr->activeRequests;
+}
+
+void RequestScheduler::schedule(Priority priority, const Runnable &request)
+{
+    d_ptr->queues[qBound<int>(HighPriority, priority, LowPriority)].enqueue(request);
+    Q_EMIT queueDepthChanged(queueDepth());
+
+    startNextRequest();
+}
+
+void RequestScheduler::startNextRequest()
+{
+    while (d_ptr->activeRequests < d_ptr->maxParallelRequests) {
+        Runnable request;
+        for (auto &queue : d_ptr->queues) {
+            if (!queue.isEmpty()) {
+                request = queue.dequeue();
+                break;
+            }
+        }
+        if (!request) {
+            return;
+        }
+
+        ++d_ptr->activeRequests;
+        Q_EMIT queueDepthChanged(queueDepth());
+
+        QPointer<RequestScheduler> that(this);
+        QSharedPointer<bool> finished(new bool(false));
+        request([that, finished]() {
+            // Guard against requests reporting completion more than once
+            if (*finished) {
+                return;
+            }
+            *finished = true;
+            if (that) {
+                --that->d_ptr->activeRequests;
+                that->startNextRequest();
+            }
+        });
+    }
+}
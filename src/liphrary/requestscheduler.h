@@ -0,0 +1,88 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PHRARY_REQUESTSCHEDULER_H
+#define PHRARY_REQUESTSCHEDULER_H
+
+#include <QObject>
+#include <QScopedPointer>
+
+#include <functional>
+
+namespace Phrary
+{
+
+/**
+ * Queues Conduit requests and makes sure that at most maxParallelRequests()
+ * of them are running at the same time.
+ *
+ * Requests are picked by priority first and then in the order in which they were
+ * scheduled, so an interactive request does not have to wait for a bulk sync
+ * to finish.
+ */
+class RequestScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Priority {
+        HighPriority = 0,
+        NormalPriority,
+        LowPriority
+    };
+
+    /**
+     * A queued request. It is started with a callback that it must invoke exactly
+     * once when the request has finished (or failed) to free its slot.
+     */
+    typedef std::function<void(const std::function<void()> &done)> Runnable;
+
+    explicit RequestScheduler(QObject *parent = Q_NULLPTR);
+    ~RequestScheduler();
+
+    void setMaxParallelRequests(int maxParallelRequests);
+    int maxParallelRequests() const;
+
+    /**
+     * Returns number of requests waiting for a free slot.
+     */
+    int queueDepth() const;
+
+    /**
+     * Returns number of requests currently running.
+     */
+    int activeRequests() const;
+
+    void schedule(Priority priority, const Runnable &request);
+
+Q_SIGNALS:
+    void queueDepthChanged(int queueDepth);
+
+private:
+    void startNextRequest();
+
+    class Private;
+    QScopedPointer<Private> const d_ptr;
+};
+
+}
+
+#endif // PHRARY_REQUESTSCHEDULER_H
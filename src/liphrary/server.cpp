@@ -20,8 +20,10 @@
  */
 
 #include "server.h"
+#include "transport_p.h"
 
 #include <QString>
+#include <QSharedPointer>
 
 using namespace Phrary;
 
@@ -29,6 +31,10 @@ class Server::Private : public QSharedData
 {
 public:
     Private()
+        : scheduler(new RequestScheduler)
+        , transport(new Transport)
+        , priority(RequestScheduler::NormalPriority)
+        , arenaAllocation(true)
     {
     }
 
@@ -36,17 +42,29 @@ public:
         : QSharedData(other)
         , host(other.host)
         , apiToken(other.apiToken)
+        , scheduler(other.scheduler)
+        , transport(other.transport)
+        , priority(other.priority)
+        , arenaAllocation(other.arenaAllocation)
     {
     }
 
     Private(const QString &host, const QString &apiToken)
         : host(host)
         , apiToken(apiToken)
+        , scheduler(new RequestScheduler)
+        , transport(new Transport)
+        , priority(RequestScheduler::NormalPriority)
+        , arenaAllocation(true)
     {
     }
 
     QString host;
     QString apiToken;
+    QSharedPointer<RequestScheduler> scheduler;
+    QSharedPointer<Transport> transport;
+    RequestScheduler::Priority priority;
+    bool arenaAllocation;
 };
 
 Server::Server()
@@ -93,3 +111,63 @@ QString Server::apiToken() const
 {
     return d_ptr->apiToken;
 }
+
+RequestScheduler *Server::scheduler() const
+{
+    return d_ptr->scheduler.data();
+}
+
+void Server::setRequestPriority(RequestScheduler::Priority priority)
+{
+    d_ptr->priority = priority;
+}
+
+RequestScheduler::Priority Server::requestPriority() const
+{
+    return d_ptr->priority;
+}
+
+void Server::setConnectionPoolSize(int poolSize)
+{
+    d_ptr->transport->setPoolSize(poolSize);
+}
+
+int Server::connectionPoolSize() const
+{
+    return d_ptr->transport->poolSize();
+}
+
+void Server::setIdleTimeout(int idleTimeout)
+{
+    d_ptr->transport->setIdleTimeout(idleTimeout);
+}
+
+int Server::idleTimeout() const
+{
+    return d_ptr->transport->idleTimeout();
+}
+
+void Server::setArenaAllocation(bool enabled)
+{
+    d_ptr->arenaAllocation = enabled;
+}
+
+bool Server::arenaAllocation() const
+{
+    return d_ptr->arenaAllocation;
+}
+
+QHash<QString, TransferStatistics> Server::transferStatistics() const
+{
+    return d_ptr->transport->statistics();
+}
+
+void Server::resetTransferStatistics()
+{
+    d_ptr->transport->resetStatistics();
+}
+
+Transport *Server::transport() const
+{
+    return d_ptr->transport.data();
+}
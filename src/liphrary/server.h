@@ -23,12 +23,37 @@
 #define SERVER_H_
 
 #include <QSharedDataPointer>
+#include <QHash>
+#include <QString>
 
-class QString;
+#include "requestscheduler.h"
 
 namespace Phrary
 {
 
+class Transport;
+
+/**
+ * Amount of data transferred by calls of a single Conduit method.
+ */
+struct TransferStatistics
+{
+    TransferStatistics()
+        : requests(0)
+        , bytesSent(0)
+        , bytesReceived(0)
+        , bytesDecoded(0)
+    {
+    }
+
+    qint64 requests;
+    qint64 bytesSent;
+    /** Size of the response bodies as transferred, possibly compressed */
+    qint64 bytesReceived;
+    /** Size of the response bodies after decompression */
+    qint64 bytesDecoded;
+};
+
 class Server
 {
 public:
@@ -44,6 +69,46 @@ public:
     void setAPIToken(const QString &token);
     QString apiToken() const;
 
+    /**
+     * Scheduler through which all requests to this server are sent. It is shared
+     * by all copies of the Server.
+     */
+    RequestScheduler *scheduler() const;
+
+    /**
+     * Priority with which requests executed with this Server are scheduled.
+     */
+    void setRequestPriority(RequestScheduler::Priority priority);
+    RequestScheduler::Priority requestPriority() const;
+
+    /**
+     * Connections to the server are kept open and reused. At most @p poolSize
+     * connections are opened (Qt does not allow more than 6), and they are
+     * closed after being idle for @p idleTimeout seconds.
+     */
+    void setConnectionPoolSize(int poolSize);
+    int connectionPoolSize() const;
+
+    void setIdleTimeout(int idleTimeout);
+    int idleTimeout() const;
+
+    /**
+     * When enabled, the tasks and transactions decoded from a single response
+     * are allocated together from one memory arena instead of one by one.
+     * The arena is released once the last of the objects is destroyed.
+     */
+    void setArenaAllocation(bool enabled);
+    bool arenaAllocation() const;
+
+    /**
+     * Returns statistics of data transferred since the Server was created, or
+     * since the last resetTransferStatistics(), keyed by Conduit method.
+     */
+    QHash<QString, TransferStatistics> transferStatistics() const;
+    void resetTransferStatistics();
+
+    Transport *transport() const;
+
 private:
     class Private;
     QSharedDataPointer<Private> d_ptr;
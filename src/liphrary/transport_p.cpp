@@ -0,0 +1,393 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "transport_p.h"
+
+#include <QNetworkAccessManager>
+#include <QNetworkProxyFactory>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QDebug>
+#include <QSharedPointer>
+#include <QStringList>
+#ifndef QT_NO_SSL
+#include <QSslError>
+#endif
+
+#include <cstring>
+
+#include <zlib.h>
+
+using namespace Phrary;
+
+static const int MaxConnectionsPerHost = 6;
+static const int MaxRedirects = 5;
+
+static bool isRedirect(QNetworkReply *reply)
+{
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    return status >= 300 && status < 400;
+}
+
+namespace {
+
+/**
+ * Incrementally decompresses gzip, zlib or raw deflate data, as servers don't
+ * agree on what "Content-Encoding: deflate" means. The format is detected
+ * from the first two bytes of the data.
+ */
+class Inflater
+{
+public:
+    Inflater()
+        : mInitialized(false)
+        , mFinished(false)
+    {
+        memset(&mStream, 0, sizeof(mStream));
+    }
+
+    ~Inflater()
+    {
+        if (mInitialized) {
+            inflateEnd(&mStream);
+        }
+    }
+
+    bool isFinished() const
+    {
+        return mFinished;
+    }
+
+    bool inflate(const QByteArray &in, QByteArray &out)
+    {
+        if (mFinished) {
+            return true;
+        }
+
+        if (!mInitialized) {
+            mHeader += in;
+            if (mHeader.size() < 2) {
+                return true;
+            }
+            if (!init()) {
+                return false;
+            }
+            const QByteArray data = mHeader;
+            mHeader.clear();
+            return inflateChunk(data, out);
+        }
+
+        return inflateChunk(in, out);
+    }
+
+private:
+    bool init()
+    {
+        const uchar b0 = static_cast<uchar>(mHeader[0]);
+        const uchar b1 = static_cast<uchar>(mHeader[1]);
+        int windowBits;
+        if (b0 == 0x1f && b1 == 0x8b) {
+            windowBits = MAX_WBITS + 16; // gzip
+        } else if ((b0 & 0x0f) == Z_DEFLATED && ((b0 << 8) | b1) % 31 == 0) {
+            windowBits = MAX_WBITS; // zlib
+        } else {
+            windowBits = -MAX_WBITS; // raw deflate
+        }
+        mInitialized = inflateInit2(&mStream, windowBits) == Z_OK;
+        return mInitialized;
+    }
+
+    bool inflateChunk(const QByteArray &in, QByteArray &out)
+    {
+        mStream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.constData()));
+        mStream.avail_in = static_cast<uInt>(in.size());
+
+        char buffer[16 * 1024];
+        do {
+            mStream.next_out = reinterpret_cast<Bytef*>(buffer);
+            mStream.avail_out = sizeof(buffer);
+            const int ret = ::inflate(&mStream, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END) {
+                mFinished = true;
+            } else if (ret == Z_BUF_ERROR) {
+                // Needs more input
+                break;
+            } else if (ret != Z_OK) {
+                return false;
+            }
+            out.append(buffer, sizeof(buffer) - mStream.avail_out);
+        } while (!mFinished && (mStream.avail_in > 0 || mStream.avail_out == 0));
+
+        return true;
+    }
+
+    z_stream mStream;
+    QByteArray mHeader;
+    bool mInitialized;
+    bool mFinished;
+};
+
+}
+
+struct Transport::ReplyDecoder
+{
+    ReplyDecoder()
+        : compressed(false)
+        , initialized(false)
+        , failed(false)
+    {
+    }
+
+    Inflater inflater;
+    QByteArray encoding;
+    QStringList sslErrors;
+    bool compressed;
+    bool initialized;
+    bool failed;
+};
+
+Transport::Transport(QObject *parent)
+    : QObject(parent)
+    , mNam(new QNetworkAccessManager(this))
+    , mPoolSize(MaxConnectionsPerHost)
+    , mActiveRequests(0)
+{
+    // Like KIO did, go through the proxy configured in the system
+    QNetworkProxyFactory::setUseSystemConfiguration(true);
+
+    mIdleTimer.setSingleShot(true);
+    mIdleTimer.setInterval(60 * 1000);
+    connect(&mIdleTimer, &QTimer::timeout, this, &Transport::closeIdleConnections);
+}
+
+Transport::~Transport()
+{
+}
+
+void Transport::setPoolSize(int poolSize)
+{
+    mPoolSize = qBound(1, poolSize, MaxConnectionsPerHost);
+    startNextRequest();
+}
+
+int Transport::poolSize() const
+{
+    return mPoolSize;
+}
+
+void Transport::setIdleTimeout(int seconds)
+{
+    mIdleTimer.setInterval(qMax(1, seconds) * 1000);
+}
+
+int Transport::idleTimeout() const
+{
+    return mIdleTimer.interval() / 1000;
+}
+
+void Transport::post(const QString &method, const QUrl &url, const QByteArray &body,
+                     const ResponseHandler &handler, const DataHandler &dataHandler)
+{
+    mPending.enqueue(PendingRequest{ method, url, body, handler, dataHandler, 0 });
+    startNextRequest();
+}
+
+void Transport::startNextRequest()
+{
+    while (mActiveRequests < mPoolSize && !mPending.isEmpty()) {
+        const PendingRequest pending = mPending.dequeue();
+
+        QNetworkRequest request(pending.url);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 8, 0)
+        request.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, true);
+#endif
+        request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysNetwork);
+        request.setHeader(QNetworkRequest::ContentTypeHeader, QStringLiteral("application/x-www-form-urlencoded"));
+        // Setting the header explicitly disables Qt's transparent decompression
+        request.setRawHeader("Accept-Encoding", "gzip, deflate");
+
+        mIdleTimer.stop();
+        ++mActiveRequests;
+        QNetworkReply *reply = mNam->post(request, pending.body);
+        const DataHandler dataHandler = pending.dataHandler;
+        const QString method = pending.method;
+        const QSharedPointer<ReplyDecoder> decoder(new ReplyDecoder);
+        if (dataHandler) {
+            connect(reply, &QNetworkReply::readyRead,
+                    this, [this, reply, method, decoder, dataHandler]() {
+                        onReplyReadyRead(reply, method, decoder.data(), dataHandler);
+                    });
+        }
+#ifndef QT_NO_SSL
+        connect(reply, &QNetworkReply::sslErrors,
+                this, [decoder](const QList<QSslError> &errors) {
+                    for (const QSslError &error : errors) {
+                        decoder->sslErrors.push_back(error.errorString());
+                    }
+                });
+#endif
+        connect(reply, &QNetworkReply::finished,
+                this, [this, reply, pending, decoder]() {
+                    onReplyFinished(reply, pending, decoder.data());
+                });
+
+        TransferStatistics &stats = mStatistics[pending.method];
+        ++stats.requests;
+        stats.bytesSent += pending.body.size();
+    }
+}
+
+bool Transport::decodeReplyData(QNetworkReply *reply, const QString &method,
+                                ReplyDecoder *decoder, QByteArray &out)
+{
+    if (!decoder->initialized) {
+        decoder->encoding = reply->rawHeader("Content-Encoding").trimmed().toLower();
+        decoder->compressed = decoder->encoding == "gzip" || decoder->encoding == "x-gzip"
+                                || decoder->encoding == "deflate";
+        decoder->initialized = true;
+    }
+
+    const QByteArray data = reply->readAll();
+    const int decodedSize = out.size();
+    bool ok = true;
+    if (decoder->compressed) {
+        ok = decoder->inflater.inflate(data, out);
+    } else {
+        out += data;
+    }
+
+    TransferStatistics &stats = mStatistics[method];
+    stats.bytesReceived += data.size();
+    stats.bytesDecoded += out.size() - decodedSize;
+    return ok;
+}
+
+void Transport::onReplyReadyRead(QNetworkReply *reply, const QString &method,
+                                 ReplyDecoder *decoder, const DataHandler &dataHandler)
+{
+    if (reply->error() != QNetworkReply::NoError) {
+        return;
+    }
+    // The body of a redirect is not the response
+    if (isRedirect(reply)) {
+        reply->readAll();
+        return;
+    }
+
+    QByteArray data;
+    if (!decodeReplyData(reply, method, decoder, data)) {
+        // Reported once the reply finishes
+        decoder->failed = true;
+        reply->abort();
+        return;
+    }
+    if (!data.isEmpty()) {
+        dataHandler(data);
+    }
+}
+
+void Transport::onReplyFinished(QNetworkReply *reply, const PendingRequest &request, ReplyDecoder *decoder)
+{
+    reply->deleteLater();
+    --mActiveRequests;
+
+    Response response;
+    response.error = reply->error();
+    if (response.error == QNetworkReply::NoError && isRedirect(reply)) {
+        if (redirect(reply, request, response)) {
+            return;
+        }
+    } else if (response.error == QNetworkReply::NoError) {
+        if (!decodeReplyData(reply, request.method, decoder, response.data)
+                || (decoder->compressed && !decoder->inflater.isFinished())) {
+            decoder->failed = true;
+        } else if (request.dataHandler && !response.data.isEmpty()) {
+            request.dataHandler(response.data);
+            response.data.clear();
+        }
+    }
+    if (decoder->failed) {
+        response.error = QNetworkReply::ProtocolFailure;
+        response.errorString = QStringLiteral("Failed to decompress %1 response").arg(QString::fromLatin1(decoder->encoding));
+        response.data.clear();
+    } else if (response.error == QNetworkReply::SslHandshakeFailedError && !decoder->sslErrors.isEmpty()) {
+        response.errorString = QStringLiteral("The SSL certificate of %1 is not trusted (%2). If the server uses "
+                                              "a self-signed certificate, add it to the trusted certificates of the system.")
+                                   .arg(request.url.host(), decoder->sslErrors.join(QStringLiteral(", ")));
+    } else if (response.error != QNetworkReply::NoError && response.errorString.isEmpty()) {
+        response.errorString = reply->errorString();
+    }
+
+    startNextRequest();
+    if (mActiveRequests == 0) {
+        mIdleTimer.start();
+    }
+
+    request.handler(response);
+}
+
+bool Transport::redirect(QNetworkReply *reply, const PendingRequest &request, Response &response)
+{
+    const QUrl target = request.url.resolved(reply->attribute(QNetworkRequest::RedirectionTargetAttribute).toUrl());
+    // The body carries the API token, never send it to another host. Qt's own
+    // FollowRedirectsAttribute would turn the POST into a GET on a 301 or 302
+    // and drop the Conduit parameters, so the request is posted again instead.
+    if (!target.isValid() || target.host() != request.url.host()) {
+        response.error = QNetworkReply::ProtocolUnknownError;
+        response.errorString = QStringLiteral("The server redirects to %1, please update the server URL")
+                                   .arg(target.toDisplayString());
+        return false;
+    }
+    if (request.redirects >= MaxRedirects) {
+        response.error = QNetworkReply::ProtocolUnknownError;
+        response.errorString = QStringLiteral("Too many redirects from %1").arg(request.url.toDisplayString());
+        return false;
+    }
+
+    PendingRequest redirected = request;
+    redirected.url = target;
+    ++redirected.redirects;
+    mPending.prepend(redirected);
+    startNextRequest();
+    return true;
+}
+
+void Transport::closeIdleConnections()
+{
+    if (mActiveRequests > 0) {
+        return;
+    }
+
+    // QNetworkAccessManager keeps its connections for as long as it lives,
+    // replacing it is the only way to close them on all Qt versions
+    mNam->deleteLater();
+    mNam = new QNetworkAccessManager(this);
+}
+
+QHash<QString, TransferStatistics> Transport::statistics() const
+{
+    return mStatistics;
+}
+
+void Transport::resetStatistics()
+{
+    mStatistics.clear();
+}
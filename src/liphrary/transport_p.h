@@ -0,0 +1,135 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PHRARY_TRANSPORT_P_H
+#define PHRARY_TRANSPORT_P_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QQueue>
+#include <QString>
+#include <QTimer>
+#include <QUrl>
+
+#include <functional>
+
+#include "server.h"
+
+class QNetworkAccessManager;
+class QNetworkReply;
+
+namespace Phrary
+{
+
+/**
+ * HTTP transport shared by all copies of a Server.
+ *
+ * All requests go through a single QNetworkAccessManager, so the connections
+ * to the server (including the TLS session) are kept alive and reused between
+ * requests. HTTP/2 is used when the server supports it, otherwise at most
+ * poolSize() HTTP/1.1 connections are opened and further requests wait
+ * for one of them. Connections are closed after being idle for idleTimeout().
+ *
+ * Responses are requested gzip or deflate compressed and decompressed here
+ * rather than by Qt, so that both the transferred and the decoded size can
+ * be accounted per Conduit method.
+ *
+ * The system proxy configuration is used. Redirects within the same host,
+ * e.g. from http to https, are followed by posting the request again to the
+ * new location. SSL errors are not ignored, they are reported in the error
+ * string of the response.
+ */
+class Transport : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Response {
+        int error;
+        QString errorString;
+        QByteArray data;
+    };
+    typedef std::function<void(const Response &)> ResponseHandler;
+    typedef std::function<void(const QByteArray &)> DataHandler;
+
+    explicit Transport(QObject *parent = Q_NULLPTR);
+    ~Transport();
+
+    /**
+     * Maximum number of connections to the server. Qt never opens more
+     * than 6 connections to a single host, so larger values are capped.
+     */
+    void setPoolSize(int poolSize);
+    int poolSize() const;
+
+    /**
+     * Time in seconds after which idle connections are closed.
+     */
+    void setIdleTimeout(int seconds);
+    int idleTimeout() const;
+
+    /**
+     * Sends @p body as an application/x-www-form-urlencoded POST request
+     * to @p url and calls @p handler once the reply is finished. The
+     * transferred data are accounted to @p method.
+     *
+     * When @p dataHandler is set, the decompressed body is passed to it
+     * piece by piece as it arrives from the network and the Response passed
+     * to @p handler carries no data.
+     */
+    void post(const QString &method, const QUrl &url, const QByteArray &body,
+              const ResponseHandler &handler, const DataHandler &dataHandler = DataHandler());
+
+    QHash<QString, TransferStatistics> statistics() const;
+    void resetStatistics();
+
+private:
+    struct PendingRequest {
+        QString method;
+        QUrl url;
+        QByteArray body;
+        ResponseHandler handler;
+        DataHandler dataHandler;
+        int redirects;
+    };
+    struct ReplyDecoder;
+
+    void startNextRequest();
+    bool decodeReplyData(QNetworkReply *reply, const QString &method,
+                         ReplyDecoder *decoder, QByteArray &out);
+    void onReplyReadyRead(QNetworkReply *reply, const QString &method,
+                          ReplyDecoder *decoder, const DataHandler &dataHandler);
+    void onReplyFinished(QNetworkReply *reply, const PendingRequest &request, ReplyDecoder *decoder);
+    bool redirect(QNetworkReply *reply, const PendingRequest &request, Response &response);
+    void closeIdleConnections();
+
+    QNetworkAccessManager *mNam;
+    QQueue<PendingRequest> mPending;
+    QHash<QString, TransferStatistics> mStatistics;
+    QTimer mIdleTimer;
+    int mPoolSize;
+    int mActiveRequests;
+};
+
+}
+
+#endif // PHRARY_TRANSPORT_P_H
@@ -22,15 +22,15 @@
 #include "user.h"
 #include "server.h"
 #include "utils_p.h"
+#include "jsonreader_p.h"
 
 #include <QUrl>
-#include <QUrlQuery>
-#include <QVariantMap>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QStringList>
 
 #include <Async>
 
-#include <QJsonDocument>
-
 using namespace Phrary;
 
 class User::Private : public QSharedData
@@ -52,30 +52,39 @@ public:
     {
     }
 
-    static User::List parse(const QVariant &result)
+    /**
+     * Parses a single user of the user.query result array.
+     */
+    static void parseElement(const QByteArray &, JsonReader &reader, User::List &users)
     {
-        const QVariantList results = result.toList();
-
-        User::List users;
-        users.reserve(results.size());
-
-        Q_FOREACH (const QVariant &l, results) {
-            const QVariantMap d = l.toMap();
-            User user;
-            user.d_ptr->phid = d[QStringLiteral("phid")].toByteArray();
-            user.d_ptr->userName = d[QStringLiteral("userName")].toString();
-            user.d_ptr->realName = d[QStringLiteral("realName")].toString();
-            user.d_ptr->image = d[QStringLiteral("image")].toUrl();
-            user.d_ptr->uri = d[QStringLiteral("uri")].toUrl();
-            user.d_ptr->roles = d[QStringLiteral("roles")].toStringList();
-
-            users.push_back(user);
+        if (!reader.enterObject()) {
+            return;
+        }
+
+        QByteArray key;
+        User user;
+        while (reader.nextKey(key)) {
+            if (key == "phid") {
+                user.d_ptr->phid = reader.readPhid();
+            } else if (key == "userName") {
+                user.d_ptr->userName = reader.readString();
+            } else if (key == "realName") {
+                user.d_ptr->realName = reader.readString();
+            } else if (key == "image") {
+                user.d_ptr->image = QUrl(reader.readString());
+            } else if (key == "uri") {
+                user.d_ptr->uri = QUrl(reader.readString());
+            } else if (key == "roles") {
+                user.d_ptr->roles = reader.readStringList();
+            } else {
+                reader.skipValue();
+            }
         }
 
-        return users;
+        users.push_back(user);
     }
 
-    QByteArray phid;
+    PhidRef phid;
     QString userName;
     QString realName;
     QUrl image;
@@ -103,12 +112,12 @@ User &User::operator=(const User &other)
     return *this;
 }
 
-QByteArray User::phid() const
+PhidRef User::phid() const
 {
     return d_ptr->phid;
 }
 
-void User::setPHID(const QByteArray &phid)
+void User::setPHID(const PhidRef &phid)
 {
     d_ptr->phid = phid;
 }
@@ -163,20 +172,29 @@ void User::setRoles(const QStringList &roles)
     d_ptr->roles = roles;
 }
 
-KAsync::Job<User::List, Server> User::query(const QVector<QByteArray> &phids)
+static KAsync::Job<User::List, Server> queryUsers(const QVector<PhidRef> &phids)
 {
-    return KAsync::start<QUrl, Server>(
+    return KAsync::start<Request, Server>(
         [phids](const Server &server) {
-            QUrlQuery query;
-            query.addQueryItem(QStringLiteral("api.token"), server.apiToken());
-            for (int i = 0; i < phids.count(); ++i) {
-                query.addQueryItem(QStringLiteral("phids[%1]").arg(i), QString::fromUtf8(phids.at(i)));
+            QJsonArray phidsArray;
+            for (const PhidRef &phid : phids) {
+                phidsArray.push_back(phid.toString());
             }
+            QJsonObject params;
+            params[QStringLiteral("phids")] = phidsArray;
+            // user.query returns only 100 users by default
+            params[QStringLiteral("limit")] = phids.size();
 
-            QUrl url(server.server());
-            url.setPath(QStringLiteral("/api/user.query"));
-            url.setQuery(query);
-            return url;
+            return Request{ server, QStringLiteral("user.query"), params };
         })
-    .then<User::List, QUrl>(&Phrary::parseResponse<User>);
+    .then<User::List, Request>(&Phrary::parseResponse<User>);
+}
+
+KAsync::Job<User::List, Server> User::query(const QVector<PhidRef> &phids)
+{
+    // The PHIDs are sent in the request body, so this only keeps the
+    // individual responses reasonably small
+    static const int MaxPHIDsPerRequest = 1000;
+
+    return queryChunked<User, PhidRef>(phids, MaxPHIDsPerRequest, &queryUsers);
 }
@@ -27,6 +27,8 @@
 
 #include <Async>
 
+#include "phid.h"
+
 class QString;
 class QByteArray;
 class QStringList;
@@ -47,10 +49,14 @@ public:
     ~User();
     User &operator=(const User &other);
 
-    static KAsync::Job<User::List, Server> query(const QVector<QByteArray> &phids = {});
+    /**
+     * Queries users with given PHIDs. Large lists are split into multiple
+     * requests that run in parallel.
+     */
+    static KAsync::Job<User::List, Server> query(const QVector<PhidRef> &phids = {});
 
-    QByteArray phid() const;
-    void setPHID(const QByteArray &phid);
+    PhidRef phid() const;
+    void setPHID(const PhidRef &phid);
 
     QString userName() const;
     void setUserName(const QString &userName);
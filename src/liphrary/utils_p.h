@@ -24,41 +24,294 @@
 
 #include <functional>
 
-#include <KIO/StoredTransferJob>
-
 #include <Async>
 
+#include "server.h"
+#include "transport_p.h"
+#include "jsonreader_p.h"
+#include "arena_p.h"
+
+#include <QDebug>
 #include <QUrl>
 #include <QJsonDocument>
+#include <QJsonObject>
+#include <QSharedPointer>
+#include <QVector>
 
 namespace Phrary {
 
+/**
+ * A call of Conduit @p method with @p params, together with the Server whose
+ * scheduler will execute it.
+ */
+struct Request
+{
+    Server server;
+    QString method;
+    QJsonObject params;
+};
+
+/**
+ * Encodes the request as an application/x-www-form-urlencoded POST body.
+ *
+ * The parameters, including the API token, are sent as JSON in the body,
+ * so they don't end up in any logs and their size is not limited by
+ * the maximum URL length.
+ */
+inline QByteArray encodeRequest(const Request &request)
+{
+    QJsonObject params = request.params;
+    QJsonObject conduit;
+    conduit[QStringLiteral("token")] = request.server.apiToken();
+    params[QStringLiteral("__conduit__")] = conduit;
+
+    return "params=" + QJsonDocument(params).toJson(QJsonDocument::Compact).toPercentEncoding()
+        + "&output=json&__conduit__=1";
+}
+
+/**
+ * Decodes the "result" value of a Conduit response. Each member of a result
+ * object, or each item of a result array, is decoded by
+ * T::Private::parseElement().
+ */
 template<typename T>
-void parseResponse(const QUrl &url,
-                    KAsync::Future<typename T::List> &future)
+typename T::List parseResult(JsonReader &reader)
 {
-    qDebug() << "Requesting" << url.toDisplayString();
-    KIO::StoredTransferJob *job = KIO::storedGet(url, KIO::NoReload, KIO::HideProgressInfo);
-    QObject::connect(job, &KIO::Job::result,
-        [future](KJob *job) {
-            auto f = future;
-            KIO::StoredTransferJob *stj = qobject_cast<KIO::StoredTransferJob*>(job);
-            if (stj->error()) {
-                qWarning() << typeid(T).name() << "request error:" << stj->errorString();
-                f.setError(stj->error(), stj->errorString());
-                return;
-            } else {
-                const QByteArray json = stj->data();
-                const QJsonDocument doc = QJsonDocument::fromJson(json);
-                const QVariantMap map = doc.toVariant().toMap();
-                if (!map[QStringLiteral("error_code")].isNull()) {
-                    qWarning() << typeid(T).name() << "API error:" << map[QStringLiteral("error_info")].toString();
-                    f.setError(map[QStringLiteral("error_code")].toInt(),
-                                map[QStringLiteral("error_info")].toString());
-                    return;
+    typename T::List result;
+    QByteArray key;
+    if (reader.peekType() == JsonReader::ArrayValue) {
+        reader.enterArray();
+        while (reader.nextElement()) {
+            T::Private::parseElement(QByteArray(), reader, result);
+        }
+    } else if (reader.enterObject()) {
+        while (reader.nextKey(key)) {
+            T::Private::parseElement(key, reader, result);
+        }
+    }
+    return result;
+}
+
+/**
+ * Decodes a Conduit response envelope. The "result" is decoded directly
+ * while walking the document, without building any intermediate
+ * QJsonDocument or QVariant tree.
+ *
+ * Returns false and fills @p errorCode and @p errorInfo when the server
+ * reported an error or when the response is not valid JSON.
+ */
+template<typename T>
+bool decodeResponse(const QByteArray &data, typename T::List &result,
+                    int &errorCode, QString &errorInfo)
+{
+    JsonReader reader(data);
+    errorCode = 0;
+    bool hasErrorCode = false;
+    if (reader.enterObject()) {
+        QByteArray key;
+        while (reader.nextKey(key)) {
+            if (key == "result") {
+                result = parseResult<T>(reader);
+            } else if (key == "error_code") {
+                if (reader.peekType() == JsonReader::NullValue) {
+                    reader.skipValue();
+                } else {
+                    hasErrorCode = true;
+                    bool ok = false;
+                    errorCode = reader.readUtf8().toInt(&ok);
+                    // Conduit error codes are strings like "ERR-CONDUIT-CORE"
+                    if (!ok || errorCode == 0) {
+                        errorCode = 1;
+                    }
                 }
-                f.setValue(T::Private::parse(map[QStringLiteral("result")]));
-                f.setFinished();
+            } else if (key == "error_info") {
+                errorInfo = reader.readString();
+            } else {
+                reader.skipValue();
+            }
+        }
+    }
+
+    if (reader.hasError()) {
+        errorCode = 1;
+        errorInfo = reader.errorString();
+        return false;
+    }
+    return !hasErrorCode;
+}
+
+/**
+ * Decodes a Conduit response while it is being received. The elements of
+ * the result are decoded as soon as they are complete, so decoding overlaps
+ * with the download and the response is never held in memory as a whole.
+ */
+template<typename T>
+class ResponseDecoder
+{
+public:
+    typedef std::function<void(const typename T::List &)> ResultHandler;
+
+    /**
+     * With @p useArena, the decoded objects are allocated from a single
+     * Arena, if T::Private supports it. If @p handler is set, it is called
+     * with the objects decoded from each result element as soon as the
+     * element is complete.
+     */
+    explicit ResponseDecoder(bool useArena = false, const ResultHandler &handler = ResultHandler())
+        : mSplitter([this](const QByteArray &key, JsonReader &reader) {
+                        Arena::Scope scope(mArena);
+                        const int count = mResult.size();
+                        T::Private::parseElement(key, reader, mResult);
+                        if (mHandler && mResult.size() > count) {
+                            mHandler(mResult.mid(count));
+                        }
+                    })
+        , mHandler(handler)
+        , mArena(useArena ? Arena::create() : Q_NULLPTR)
+    {
+    }
+
+    ~ResponseDecoder()
+    {
+        // The objects keep the arena alive for as long as they need it
+        if (mArena) {
+            mArena->deref();
+        }
+    }
+
+    void append(const QByteArray &data)
+    {
+        mSplitter.append(data);
+    }
+
+    bool finish(typename T::List &result, int &errorCode, QString &errorInfo)
+    {
+        typename T::List envelopeResult;
+        if (!decodeResponse<T>(mSplitter.envelope(), envelopeResult, errorCode, errorInfo)) {
+            return false;
+        }
+        if (mSplitter.hasError()) {
+            errorCode = 1;
+            errorInfo = mSplitter.errorString();
+            return false;
+        }
+        // Non-empty only when the result was not an object or an array
+        result = mResult + envelopeResult;
+        return true;
+    }
+
+private:
+    Q_DISABLE_COPY(ResponseDecoder)
+
+    JsonResultSplitter mSplitter;
+    typename T::List mResult;
+    ResultHandler mHandler;
+    Arena *mArena;
+};
+
+/**
+ * Runs @p request and completes @p future with the decoded result. The
+ * response is decoded while it is being received, if @p handler is set it is
+ * called with the decoded objects of each result element as soon as the
+ * element has been received.
+ */
+template<typename T>
+void streamResponse(const Request &request,
+                    KAsync::Future<typename T::List> &future,
+                    const typename ResponseDecoder<T>::ResultHandler &handler)
+{
+    const Server server = request.server;
+    const QString method = request.method;
+    QUrl url(server.server());
+    url.setPath(QStringLiteral("/api/") + method);
+    const QByteArray body = encodeRequest(request);
+    // The runnable holds a copy of the server to keep the scheduler and the
+    // transport alive until the request finishes
+    server.scheduler()->schedule(server.requestPriority(),
+        [server, method, url, body, future, handler](const std::function<void()> &done) {
+            qDebug() << "Requesting" << method << "(" << body.size() << "bytes )";
+            const QSharedPointer<ResponseDecoder<T>> decoder(new ResponseDecoder<T>(server.arenaAllocation(), handler));
+            server.transport()->post(method, url, body,
+                [server, future, done, decoder](const Transport::Response &response) {
+                    done();
+
+                    auto f = future;
+                    if (response.error) {
+                        qWarning() << typeid(T).name() << "request error:" << response.errorString;
+                        f.setError(response.error, response.errorString);
+                        return;
+                    }
+
+                    typename T::List result;
+                    int errorCode;
+                    QString errorInfo;
+                    if (!decoder->finish(result, errorCode, errorInfo)) {
+                        qWarning() << typeid(T).name() << "API error:" << errorInfo;
+                        f.setError(errorCode, errorInfo);
+                        return;
+                    }
+                    f.setValue(result);
+                    f.setFinished();
+                },
+                [decoder](const QByteArray &data) {
+                    decoder->append(data);
+                });
+        });
+}
+
+template<typename T>
+void parseResponse(const Request &request,
+                   KAsync::Future<typename T::List> &future)
+{
+    streamResponse<T>(request, future, typename ResponseDecoder<T>::ResultHandler());
+}
+
+/**
+ * Splits @p keys into chunks of at most @p chunkSize keys, runs the job returned
+ * by @p jobForChunk for each of them and merges the results. The chunks are
+ * all submitted at once and run in parallel as far as the server's
+ * scheduler allows.
+ */
+template<typename T, typename Key>
+KAsync::Job<typename T::List, Server> queryChunked(const QVector<Key> &keys, int chunkSize,
+                                                   const std::function<KAsync::Job<typename T::List, Server>(const QVector<Key> &)> &jobForChunk)
+{
+    if (keys.size() <= chunkSize) {
+        return jobForChunk(keys);
+    }
+
+    return KAsync::start<typename T::List, Server>(
+        [keys, chunkSize, jobForChunk](const Server &server, KAsync::Future<typename T::List> &future) {
+            struct State {
+                typename T::List results;
+                int pendingChunks;
+                bool failed;
+            };
+            QSharedPointer<State> state(new State{ typename T::List(), (keys.size() + chunkSize - 1) / chunkSize, false });
+            state->results.reserve(keys.size());
+
+            for (int i = 0; i < keys.size(); i += chunkSize) {
+                auto watcher = new KAsync::FutureWatcher<typename T::List>();
+                QObject::connect(watcher, &KAsync::FutureWatcherBase::futureReady,
+                    [watcher, state, future]() {
+                        auto f = future;
+                        const auto chunkFuture = watcher->future();
+                        watcher->deleteLater();
+                        if (state->failed) {
+                            return;
+                        }
+                        if (chunkFuture.errorCode()) {
+                            state->failed = true;
+                            f.setError(chunkFuture.errorCode(), chunkFuture.errorMessage());
+                            return;
+                        }
+                        state->results += chunkFuture.value();
+                        if (--state->pendingChunks == 0) {
+                            f.setValue(state->results);
+                            f.setFinished();
+                        }
+                    });
+                watcher->setFuture(jobForChunk(keys.mid(i, chunkSize)).exec(server));
             }
         });
 }
@@ -0,0 +1,241 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "markupcache.h"
+#include "debug.h"
+#include "liphrary/markup.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QVector>
+
+#include <iterator>
+
+static const quint32 CacheMagic = 0x50484d43; // "PHMC"
+static const quint32 CacheVersion = 3;
+// The oldest Qt we support, so the file doesn't depend on the Qt we are built with
+static const QDataStream::Version StreamVersion = QDataStream::Qt_5_3;
+
+MarkupCache::MarkupCache(QObject *parent)
+    : QObject(parent)
+    , mCost(0)
+    , mMaxCost(0)
+    , mDirty(false)
+{
+    setMaxSize(16 * 1024);
+}
+
+MarkupCache::~MarkupCache()
+{
+    save();
+}
+
+void MarkupCache::setFileName(const QString &fileName)
+{
+    QMutexLocker locker(&mMutex);
+    mFileName = fileName;
+}
+
+QString MarkupCache::fileName() const
+{
+    QMutexLocker locker(&mMutex);
+    return mFileName;
+}
+
+void MarkupCache::setMaxSize(int kilobytes)
+{
+    QMutexLocker locker(&mMutex);
+    // The cost of each entry is the number of QChars
+    mMaxCost = qint64(kilobytes) * 1024 / sizeof(QChar);
+    evict();
+}
+
+int MarkupCache::maxSize() const
+{
+    QMutexLocker locker(&mMutex);
+    return static_cast<int>(mMaxCost * sizeof(QChar) / 1024);
+}
+
+QByteArray MarkupCache::key(const QString &markup)
+{
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    const qint32 rendererVersion = Phrary::Markup::RendererVersion;
+    hash.addData(reinterpret_cast<const char *>(&rendererVersion), sizeof(rendererVersion));
+    hash.addData(Phrary::Markup::phabricatorUrl().toUtf8());
+    hash.addData("\0", 1);
+    hash.addData(reinterpret_cast<const char *>(markup.constData()), markup.size() * sizeof(QChar));
+    return hash.result();
+}
+
+void MarkupCache::insert(const QByteArray &hash, const QString &html)
+{
+    // Like QCache, don't let a single huge entry flush everything else
+    if (html.size() > mMaxCost) {
+        return;
+    }
+
+    const auto it = mIndex.constFind(hash);
+    if (it != mIndex.cend()) {
+        mCost -= it.value()->html.size();
+        mEntries.erase(it.value());
+    }
+    mEntries.push_front(Entry{ hash, html });
+    mIndex.insert(hash, mEntries.begin());
+    mCost += html.size();
+    evict();
+}
+
+void MarkupCache::evict()
+{
+    while (mCost > mMaxCost && !mEntries.empty()) {
+        mCost -= mEntries.back().html.size();
+        mIndex.remove(mEntries.back().hash);
+        mEntries.pop_back();
+    }
+}
+
+QString MarkupCache::toHTML(const QString &markup)
+{
+    if (markup.isEmpty()) {
+        return QString();
+    }
+
+    QMutexLocker locker(&mMutex);
+    if (mMaxCost == 0) {
+        locker.unlock();
+        return Phrary::Markup::markupToHTML(markup);
+    }
+    locker.unlock();
+
+    const QByteArray hash = key(markup);
+    locker.relock();
+    const auto it = mIndex.constFind(hash);
+    if (it != mIndex.cend()) {
+        // Move to the front, the iterators stay valid
+        mEntries.splice(mEntries.begin(), mEntries, it.value());
+        return it.value()->html;
+    }
+    locker.unlock();
+
+    const QString html = Phrary::Markup::markupToHTML(markup);
+
+    locker.relock();
+    insert(hash, html);
+    mDirty = true;
+    return html;
+}
+
+void MarkupCache::load()
+{
+    QMutexLocker locker(&mMutex);
+    if (mFileName.isEmpty()) {
+        return;
+    }
+
+    QFile file(mFileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(StreamVersion);
+    quint32 magic, version;
+    stream >> magic >> version;
+    if (magic != CacheMagic || version != CacheVersion) {
+        qCWarning(LOG) << "Ignoring markup cache" << mFileName << "with unknown format";
+        return;
+    }
+
+    // HTML rendered by a different renderer may not be what it renders now
+    qint32 rendererVersion;
+    stream >> rendererVersion;
+    if (rendererVersion != Phrary::Markup::RendererVersion) {
+        qCDebug(LOG) << "Discarding markup cache" << mFileName << "of renderer version" << rendererVersion;
+        return;
+    }
+
+    // The entries are stored from the most recently used, so each one goes
+    // behind the previous. Whatever no longer fits is the least recently used.
+    quint32 count;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QByteArray hash;
+        QString html;
+        stream >> hash >> html;
+        if (mIndex.contains(hash) || mCost + html.size() > mMaxCost) {
+            continue;
+        }
+        mEntries.push_back(Entry{ hash, html });
+        mIndex.insert(hash, std::prev(mEntries.end()));
+        mCost += html.size();
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(LOG) << "Markup cache" << mFileName << "is corrupted, discarding it";
+        mEntries.clear();
+        mIndex.clear();
+        mCost = 0;
+        return;
+    }
+
+    qCDebug(LOG) << "Loaded" << mIndex.size() << "rendered descriptions from" << mFileName;
+}
+
+void MarkupCache::save()
+{
+    // Only copy the entries under the lock, the HTML is implicitly shared, so
+    // that the writing does not block threads rendering in the meantime.
+    // Walking the list does not change the order of use.
+    QMutexLocker locker(&mMutex);
+    if (!mDirty || mFileName.isEmpty()) {
+        return;
+    }
+    mDirty = false;
+    const QString fileName = mFileName;
+    QVector<QPair<QByteArray, QString>> entries;
+    entries.reserve(mIndex.size());
+    for (const Entry &entry : mEntries) {
+        entries.push_back(qMakePair(entry.hash, entry.html));
+    }
+    locker.unlock();
+
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(LOG) << "Failed to open markup cache" << fileName << "for writing:" << file.errorString();
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(StreamVersion);
+    stream << CacheMagic << CacheVersion << static_cast<qint32>(Phrary::Markup::RendererVersion)
+           << static_cast<quint32>(entries.size());
+    for (const auto &entry : entries) {
+        stream << entry.first << entry.second;
+    }
+
+    if (!file.commit()) {
+        qCWarning(LOG) << "Failed to write markup cache" << fileName << ":" << file.errorString();
+    }
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MARKUPCACHE_H
+#define MARKUPCACHE_H
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+
+#include <list>
+
+/**
+ * Cache of task descriptions and comments rendered to HTML.
+ *
+ * Entries are keyed by a hash of the markup, of the Phabricator URL the
+ * references in it are resolved against and of the renderer version, so a
+ * task that did not change is never rendered again. The least recently used
+ * entries are evicted once the rendered HTML exceeds maxSize(). When a file
+ * name is set, the cache is loaded from it when the resource starts. It is
+ * written back by save(), which the resource calls once a sync is done and
+ * when it quits, so that a sync does not rewrite the whole file over and
+ * over. The file keeps the entries from the most to the least recently used,
+ * so the eviction order survives restarts.
+ *
+ * toHTML() may be called from any thread, the rendering itself is done
+ * outside of the lock.
+ */
+class MarkupCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MarkupCache(QObject *parent = Q_NULLPTR);
+    ~MarkupCache();
+
+    void setFileName(const QString &fileName);
+    QString fileName() const;
+
+    /**
+     * Maximum size of the cached HTML in kilobytes, 0 disables the cache.
+     */
+    void setMaxSize(int kilobytes);
+    int maxSize() const;
+
+    /**
+     * Returns @p markup rendered to HTML, rendering it only if it is not
+     * in the cache yet.
+     */
+    QString toHTML(const QString &markup);
+
+    void load();
+
+    /**
+     * Writes the cache to fileName() if it changed since it was last saved.
+     */
+    void save();
+
+private:
+    struct Entry {
+        QByteArray hash;
+        QString html;
+    };
+    typedef std::list<Entry> EntryList;
+
+    static QByteArray key(const QString &markup);
+    void insert(const QByteArray &hash, const QString &html);
+    void evict();
+
+    mutable QMutex mMutex;
+    // Most recently used first
+    EntryList mEntries;
+    QHash<QByteArray, EntryList::iterator> mIndex;
+    qint64 mCost;
+    qint64 mMaxCost;
+    QString mFileName;
+    bool mDirty;
+};
+
+#endif // MARKUPCACHE_H
@@ -21,15 +21,30 @@
 
 #include "resource.h"
 
+#include <QDateTime>
 #include <QScopedPointer>
+#include <QFutureWatcher>
+#include <QtConcurrentRun>
+#include <QSet>
+#include <QStandardPaths>
+#include <QSharedPointer>
 #include <QUrl>
 
+#include <AkonadiCore/AttributeFactory>
 #include <AkonadiCore/Collection>
 #include <AkonadiCore/EntityDisplayAttribute>
 #include <AkonadiCore/CachePolicy>
+#include <AkonadiCore/CollectionModifyJob>
+#include <AkonadiCore/ItemFetchJob>
+#include <AkonadiCore/ItemFetchScope>
+#include <AkonadiCore/ItemModifyJob>
 
 #include "configdialog.h"
+#include "debug.h"
 #include "settings.h"
+#include "taskconverter.h"
+#include "taskheaderattribute.h"
+#include "tasksync.h"
 #include "liphrary/server.h"
 #include "liphrary/project.h"
 #include "liphrary/maniphest.h"
@@ -37,13 +52,85 @@
 #include "liphrary/markup.h"
 
 #include <KCalCore/Todo>
-#include <KCalCore/Attendee>
 
 #include <KAsync/Async>
 
 #include <KLocalizedString>
 
-QHash<QByteArray, Phrary::User> PhabricatorResource::mUserCache;
+namespace {
+
+/**
+ * Sync state stored in the remote revision of each project collection in
+ * the form "WATERMARK:LASTFULLSYNC", where WATERMARK is the dateModified of
+ * the most recently modified task on the server when the last sync started
+ * and LASTFULLSYNC is the time of the last non-incremental sync, both as
+ * seconds since epoch.
+ */
+struct SyncRevision
+{
+    SyncRevision()
+        : watermark(0)
+        , lastFullSync(0)
+    {
+    }
+
+    static SyncRevision fromString(const QString &str)
+    {
+        SyncRevision revision;
+        const int sep = str.indexOf(QLatin1Char(':'));
+        if (sep > -1) {
+            revision.watermark = str.leftRef(sep).toUInt();
+            revision.lastFullSync = str.midRef(sep + 1).toUInt();
+        }
+        return revision;
+    }
+
+    QString toString() const
+    {
+        return QStringLiteral("%1:%2").arg(watermark).arg(lastFullSync);
+    }
+
+    bool operator==(const SyncRevision &other) const
+    {
+        return watermark == other.watermark && lastFullSync == other.lastFullSync;
+    }
+
+    uint watermark;
+    uint lastFullSync;
+};
+
+}
+
+struct PhabricatorResource::ItemSyncState
+{
+    Akonadi::Collection collection;
+    SyncRevision revision;
+    SyncRevision newRevision;
+    uint startTime;
+    bool incremental;
+    bool headersOnly;
+    // Tasks whose cached payload is outdated, in the headers-only mode
+    QStringList changedRemoteIds;
+    // Tasks modified outside of the project, in the incremental mode
+    QStringList otherTasks;
+    QHash<QString, Phrary::TransferStatistics> transferStatistics;
+};
+
+struct PhabricatorResource::PageConversion
+{
+    PageConversion()
+        : running(0)
+    {
+    }
+
+    Akonadi::Collection collection;
+    QSet<uint> started;
+    QHash<uint, Akonadi::Item> items;
+    int running;
+    // Set once the whole page has been fetched
+    Phrary::Maniphest::Task::List tasks;
+    std::function<void(const Akonadi::Item::List &)> done;
+};
 
 PhabricatorResource::PhabricatorResource(const QString &identifier)
     : Akonadi::ResourceBase(identifier)
@@ -52,12 +139,25 @@ PhabricatorResource::PhabricatorResource(const QString &identifier)
     connect(this, &Akonadi::AgentBase::reloadConfiguration,
             this, &PhabricatorResource::doReconfigure);
 
+    Akonadi::AttributeFactory::registerAttribute<TaskHeaderAttribute>();
+
+    mUserCache.setFileName(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)
+                           + QLatin1Char('/') + identifier + QStringLiteral("/users.cache"));
+    mUserCache.load();
+
     // Initialize server configuration
     doReconfigure();
+    mMarkupCache.load();
 }
 
 PhabricatorResource::~PhabricatorResource()
 {
+    // Tasks still being converted use this and the caches. Only our own
+    // conversions are waited for, not everything on the global thread pool.
+    Q_FOREACH (QFuture<Akonadi::Item> conversion, mConversions) {
+        conversion.cancel();
+        conversion.waitForFinished();
+    }
 }
 
 void PhabricatorResource::abortActivity()
@@ -67,6 +167,8 @@ void PhabricatorResource::abortActivity()
 void PhabricatorResource::aboutToQuit()
 {
     abortActivity();
+    mUserCache.save();
+    mMarkupCache.save();
 }
 
 void PhabricatorResource::configure(WId windowId)
@@ -97,80 +199,204 @@ void PhabricatorResource::doReconfigure()
                       "Phabricator Resource (%1)", Settings::self()->url()));
         Phrary::Markup::setPhabricatorUrl(Settings::self()->url());
     }
+
+    // Keep the server (and with it the request queue) unless the configuration
+    // really changed
+    if (mServer.server() != Settings::self()->url() || mServer.apiToken() != Settings::self()->aPIToken()) {
+        mServer = Phrary::Server(Settings::self()->url(), Settings::self()->aPIToken());
+        Phrary::RequestScheduler *scheduler = mServer.scheduler();
+        connect(scheduler, &Phrary::RequestScheduler::queueDepthChanged,
+                this, [scheduler](int queueDepth) {
+                    qCDebug(LOG) << "Request queue depth:" << queueDepth
+                                 << "(" << scheduler->activeRequests() << "running)";
+                });
+    }
+    mServer.scheduler()->setMaxParallelRequests(Settings::self()->maxParallelRequests());
+    mServer.setConnectionPoolSize(Settings::self()->connectionPoolSize());
+    mServer.setIdleTimeout(Settings::self()->connectionIdleTimeout());
+    mServer.setArenaAllocation(Settings::self()->arenaAllocation());
+    mUserCache.setTimeToLive(Settings::self()->userCacheTimeToLive() * 3600);
+    mMarkupCache.setMaxSize(Settings::self()->markupCacheSize());
+    mMarkupCache.setFileName(Settings::self()->persistMarkupCache()
+                             ? QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)
+                                 + QLatin1Char('/') + identifier() + QStringLiteral("/markup.cache")
+                             : QString());
+}
+
+Phrary::Server PhabricatorResource::server(Phrary::RequestScheduler::Priority priority) const
+{
+    Phrary::Server server(mServer);
+    server.setRequestPriority(priority);
+    return server;
+}
+
+void PhabricatorResource::logTransferStatistics(const QHash<QString, Phrary::TransferStatistics> &since) const
+{
+    // The statistics of the server are cumulative, log only what was transferred
+    // since the snapshot. That includes requests of retrieveItem() running meanwhile.
+    const auto stats = mServer.transferStatistics();
+    for (auto it = stats.cbegin(), end = stats.cend(); it != end; ++it) {
+        const Phrary::TransferStatistics before = since.value(it.key());
+        const qint64 requests = it->requests - before.requests;
+        if (requests == 0) {
+            continue;
+        }
+        const qint64 bytesSent = it->bytesSent - before.bytesSent;
+        const qint64 bytesReceived = it->bytesReceived - before.bytesReceived;
+        const qint64 bytesDecoded = it->bytesDecoded - before.bytesDecoded;
+        qCDebug(LOG) << it.key() << ":" << requests << "requests," << bytesSent << "bytes sent,"
+                     << bytesReceived << "bytes received," << bytesDecoded << "bytes decoded"
+                     << "(" << (bytesDecoded > 0 ? 100 * bytesReceived / bytesDecoded : 100) << "% )";
+    }
+}
+
+void PhabricatorResource::headerToItem(const Phrary::Maniphest::Task &task, Akonadi::Item &item) const
+{
+    item.setRemoteId(QString::fromLatin1(task.phid()));
+    item.setRemoteRevision(QString::number(task.dateModified().toTime_t()));
+    item.setMimeType(KCalCore::Todo::todoMimeType());
+
+    auto header = item.attribute<TaskHeaderAttribute>(Akonadi::Item::AddIfMissing);
+    header->setSummary(TaskConverter::summary(task));
+    header->setPriority(Phrary::Maniphest::iCalPriority(task.priority()));
+    header->setStatus(task.statusName());
+    header->setCompleted(task.isClosed());
+    header->setUrl(task.uri());
 }
 
 void PhabricatorResource::payloadToItem(const Phrary::Maniphest::Task &task,
                                         const Phrary::Maniphest::Transaction::List &taskTransactions,
                                         Akonadi::Item &item)
 {
-    item.setRemoteId(QString::fromUtf8(task.phid()));
-    item.setRemoteRevision(QString::number(task.dateModified().toTime_t()));
-
-    KCalCore::Todo *todo = new KCalCore::Todo;
-    todo->setUid(item.remoteId());
-    todo->setSummary(QStringLiteral("[%1] %2").arg(QString::fromUtf8(task.objectName()), task.title()));
-    todo->setCompleted(task.isClosed());
-    todo->setUrl(task.uri());
-    if (task.priority() == QLatin1String("Wishlist")) {
-        todo->setPriority(1);
-    } else if (task.priority() == QLatin1String("Low")) {
-        todo->setPriority(3);
-    } else if (task.priority() == QLatin1String("Normal")) {
-        todo->setPriority(5);
-    } else if (task.priority() == QLatin1String("High")) {
-        todo->setPriority(7);
-    } else if (task.priority() == QLatin1String("Unbreak Now!")) {
-        todo->setPriority(9);
-    } else if (task.priority() == QLatin1String("Needs Triage")) {
-        todo->setPriority(0);
-    } else {
-        qWarning() << "Unknown task priority" << task.priority();
-    }
+    headerToItem(task, item);
+    item.setPayload<KCalCore::Todo::Ptr>(TaskConverter::toTodo(task, taskTransactions, mUserCache, mMarkupCache));
+}
 
-    todo->setOrganizer(mUserCache.value(task.authorPHID()).realName());
-    Q_FOREACH (const QByteArray &cc, task.ccPHIDs()) {
-        KCalCore::Attendee attee(mUserCache.value(cc).realName(), QString());
-        todo->addAttendee(attee);
+void PhabricatorResource::tasksToItems(const TaskSync::Page &page, ItemSyncState &state,
+                                       const QSharedPointer<PageConversion> &conversion,
+                                       KAsync::Future<Akonadi::Item::List> &future)
+{
+    const Akonadi::Collection collection = state.collection;
+    if (state.headersOnly) {
+        Akonadi::Item::List items;
+        items.reserve(page.tasks.size());
+        for (const auto &task : page.tasks) {
+            Akonadi::Item item;
+            item.setParentCollection(collection);
+            headerToItem(task, item);
+            // A full sync also sees all the unchanged tasks, their payloads
+            // are still good. The watermark itself is inclusive, a task may
+            // have been modified again within the same second.
+            if (state.incremental || task.dateModified().toTime_t() >= state.revision.watermark) {
+                state.changedRemoteIds.push_back(item.remoteId());
+            }
+            items.push_back(item);
+        }
+        future.setValue(items);
+        future.setFinished();
+        return;
     }
 
-    QString description = Phrary::Markup::markupToHTML(task.description())
-        + QStringLiteral("<br><br><hr><br>");
+    // Most tasks have been converted while the page was being fetched
+    convertTasks(page, conversion);
+    conversion->tasks = page.tasks;
+    conversion->done = [future](const Akonadi::Item::List &items) {
+        auto f = future;
+        f.setValue(items);
+        f.setFinished();
+    };
+    finishConversion(conversion);
+}
 
-    int commentsCount = 0;
-    // Iterate in reverse order, because Conduit returns transactions in order
-    // from newest to oldest, which makes no sense when displaying comments
-    auto iter = taskTransactions.cend();
-    while (iter != taskTransactions.cbegin()) {
-        --iter;
-        if (iter->transactionType() != "core:comment") {
+void PhabricatorResource::convertTasks(const TaskSync::Page &page, const QSharedPointer<PageConversion> &conversion)
+{
+    const Akonadi::Collection collection = conversion->collection;
+    const bool parallel = Settings::self()->parallelItemConversion();
+    for (const auto &task : page.tasks) {
+        if (conversion->started.contains(task.id())) {
             continue;
         }
-
-        ++commentsCount;
-        auto author = mUserCache.constFind(iter->authorPHID());
-        if (author == mUserCache.constEnd()) {
-            description += i18nc("Header to a task comment: On DATE, unknown user wrote",
-                                 "On %1, unknown user wrote:",
-                                 iter->dateCreated().toString(Qt::LocaleDate));
-        } else {
-            description += i18nc("Header to a task comment: On DATE, REAL NAME (USERNAME) wrote",
-                                 "On %1, %2 (%3) wrote:",
-                                 iter->dateCreated().toString(Qt::LocalDate),
-                                 author->realName(),
-                                 author->userName());
+        conversion->started.insert(task.id());
+
+        const Phrary::Maniphest::Transaction::List transactions = page.transactions.value(task.id());
+        if (!parallel) {
+            Akonadi::Item item;
+            item.setParentCollection(collection);
+            payloadToItem(task, transactions, item);
+            conversion->items.insert(task.id(), item);
+            continue;
         }
-        description += QStringLiteral("<br>%1<br><hr>").arg(Phrary::Markup::markupToHTML(iter->comments()));
+
+        // Rendering the markup is by far the most expensive part of a sync, spread
+        // it over all cores. The event loop keeps running in the meantime, both the
+        // user cache and the markup cache can be used from several threads.
+        ++conversion->running;
+        const uint taskId = task.id();
+        auto watcher = new QFutureWatcher<Akonadi::Item>(this);
+        connect(watcher, &QFutureWatcherBase::finished,
+                this, [this, watcher, conversion, taskId]() {
+                    watcher->deleteLater();
+                    mConversions.removeOne(watcher->future());
+                    conversion->items.insert(taskId, watcher->result());
+                    --conversion->running;
+                    finishConversion(conversion);
+                });
+        const QFuture<Akonadi::Item> future = QtConcurrent::run([this, collection, task, transactions]() {
+            Akonadi::Item item;
+            item.setParentCollection(collection);
+            payloadToItem(task, transactions, item);
+            return item;
+        });
+        mConversions.push_back(future);
+        watcher->setFuture(future);
+    }
+}
+
+void PhabricatorResource::finishConversion(const QSharedPointer<PageConversion> &conversion)
+{
+    if (!conversion->done || conversion->running > 0) {
+        return;
     }
-    if (commentsCount == 0) {
-        description = Phrary::Markup::markupToHTML(task.description());
+
+    // The items are handed over in the same order as the tasks
+    Akonadi::Item::List items;
+    items.reserve(conversion->tasks.size());
+    for (const auto &task : conversion->tasks) {
+        items.push_back(conversion->items.value(task.id()));
     }
-    todo->setDescription(description, true);
+    const auto done = conversion->done;
+    conversion->done = Q_NULLPTR;
+    done(items);
+}
 
-    // This must be set as last, otherwise all other set* are ignored
-    todo->setReadOnly(true);
+void PhabricatorResource::invalidatePayloads(const Akonadi::Collection &collection, const QStringList &remoteIds)
+{
+    if (remoteIds.isEmpty()) {
+        return;
+    }
 
-    item.setMimeType(KCalCore::Todo::todoMimeType());
-    item.setPayload<KCalCore::Todo::Ptr>(KCalCore::Todo::Ptr(todo));
+    // ItemSync merges the headers into the existing items and keeps the parts
+    // they don't carry, so the outdated payloads have to be dropped explicitly.
+    // ItemModifyJob sends an item with clearPayload() as a cache invalidation
+    // of all its payload parts, the next client asking for one of them gets it
+    // from retrieveItem(). The job is queued in the default session behind
+    // the ItemSync, so even the items it has just created exist by then.
+    Akonadi::Item::List items;
+    items.reserve(remoteIds.size());
+    for (const QString &remoteId : remoteIds) {
+        Akonadi::Item item;
+        item.setRemoteId(remoteId);
+        item.setParentCollection(collection);
+        item.clearPayload();
+        items.push_back(item);
+    }
+    auto job = new Akonadi::ItemModifyJob(items, this);
+    job->disableRevisionCheck();
+    connect(job, &KJob::result, this, [](KJob *job) {
+        if (job->error()) {
+            qCWarning(LOG) << "Failed to invalidate changed tasks:" << job->errorString();
+        }
+    });
 }
 
 void PhabricatorResource::retrieveCollections()
@@ -197,7 +423,7 @@ void PhabricatorResource::retrieveCollections()
                 [&rootCollection](const Phrary::Project &project) {
                     Akonadi::Collection collection;
                     collection.setName(project.name());
-                    collection.setRemoteId(QString::fromUtf8(project.phid()));
+                    collection.setRemoteId(project.phid().toString());
                     auto attribute = collection.attribute<Akonadi::EntityDisplayAttribute>(Akonadi::Collection::AddIfMissing);
                     attribute->setDisplayName(project.name());
                     collection.setContentMimeTypes({ KCalCore::Todo::todoMimeType() });
@@ -211,110 +437,229 @@ void PhabricatorResource::retrieveCollections()
             [this, rootCollection](const Akonadi::Collection::List &collections) {
                 collectionsRetrieved(Akonadi::Collection::List{ rootCollection } +  collections);
             })
-        .exec(Phrary::Server(Settings::self()->url(), Settings::self()->aPIToken()));
+        .exec(server(Phrary::RequestScheduler::NormalPriority));
 }
 
 bool PhabricatorResource::retrieveItem(const Akonadi::Item &item, const QSet<QByteArray> &parts)
 {
     Q_UNUSED(parts);
 
-    Phrary::Maniphest::queryTasksByPHID({ item.remoteId() })
-        .then<void, Phrary::Maniphest::Task::List>(
-            [this, item](const Phrary::Maniphest::Task::List &tasks)
-            {
-                if (tasks.count() == 0) {
-                    // error
-                    cancelTask();
+    // Someone is waiting for this item, let it skip any running sync
+    const Phrary::Server server = this->server(Phrary::RequestScheduler::HighPriority);
+    TaskSync::fetchTasks({ item.remoteId() }, server, &mUserCache)
+        .then<void, TaskSync::Page>(
+            [this, item](const TaskSync::Page &page) {
+                if (page.tasks.isEmpty()) {
+                    cancelTask(i18n("Task %1 not found on the server", item.remoteId()));
                     return;
                 }
 
-                const Phrary::Maniphest::Task &task = tasks[0];
-
-                auto future = Phrary::Maniphest::queryTransactionsByTask(QVector<uint>{ task.id() })
-                    .exec(Phrary::Server(Settings::self()->url(), Settings::self()->aPIToken()));
-                // FIXME: nope nope nope nope nope nope nope nope
-                future.waitForFinished();
-
+                const Phrary::Maniphest::Task &task = page.tasks[0];
                 Akonadi::Item i(item);
-                PhabricatorResource::payloadToItem(task, future.value(), i);
+                payloadToItem(task, page.transactions.value(task.id()), i);
                 itemRetrieved(i);
+            },
+            [this](int errorCode, const QString &errorMessage) {
+                Q_UNUSED(errorCode);
+                cancelTask(errorMessage);
             })
-        .exec(Phrary::Server(Settings::self()->url(), Settings::self()->aPIToken()));
+        .exec(server);
 
     return true;
 }
 
-void PhabricatorResource::fetchUsers(const QVector<QByteArray> &phids)
+bool PhabricatorResource::retrieveItems(const Akonadi::Item::List &items, const QSet<QByteArray> &parts)
 {
-    auto future = Phrary::User::query(phids)
-        .exec(Phrary::Server(Settings::self()->url(), Settings::self()->aPIToken()));
-    // FIXME: Nope nope nope nope nope nope
-    future.waitForFinished();
+    Q_UNUSED(parts);
 
-    Q_FOREACH (const Phrary::User &user, future.value()) {
-        mUserCache.insert(user.phid(), user);
+    const Phrary::Server server = this->server(Phrary::RequestScheduler::HighPriority);
+    QStringList phids;
+    phids.reserve(items.size());
+    for (const auto &item : items) {
+        phids.push_back(item.remoteId());
     }
+
+    TaskSync::fetchTasks(phids, server, &mUserCache)
+        .then<void, TaskSync::Page>(
+            [this, items](const TaskSync::Page &page) {
+                QHash<QString, int> taskIndex;
+                taskIndex.reserve(page.tasks.size());
+                for (int i = 0; i < page.tasks.size(); ++i) {
+                    taskIndex.insert(QString::fromLatin1(page.tasks[i].phid()), i);
+                }
+
+                Akonadi::Item::List retrieved;
+                retrieved.reserve(items.size());
+                for (const auto &item : items) {
+                    const int index = taskIndex.value(item.remoteId(), -1);
+                    if (index == -1) {
+                        cancelTask(i18n("Task %1 not found on the server", item.remoteId()));
+                        return;
+                    }
+
+                    const Phrary::Maniphest::Task &task = page.tasks[index];
+                    Akonadi::Item i(item);
+                    payloadToItem(task, page.transactions.value(task.id()), i);
+                    retrieved.push_back(i);
+                }
+                itemsRetrieved(retrieved);
+            },
+            [this](int errorCode, const QString &errorMessage) {
+                Q_UNUSED(errorCode);
+                cancelTask(errorMessage);
+            })
+        .exec(server);
+
+    return true;
 }
 
 void PhabricatorResource::retrieveItems(const Akonadi::Collection &collection)
 {
-    Phrary::Maniphest::queryTasksByProject(collection.remoteId())
-        .then<Akonadi::Item::List, Phrary::Maniphest::Task::List>(
-            [this, collection](const Phrary::Maniphest::Task::List &tasks) {
-                Akonadi::Item::List items;
-                for (const auto &task : tasks) {
-                    QVector<QByteArray> usersToFetch;
-                    auto author = mUserCache.constFind(task.authorPHID());
-                    if (author == mUserCache.cend()) {
-                        usersToFetch.push_back(task.authorPHID());
-                    }
-                    Q_FOREACH (const QByteArray &user, task.ccPHIDs()) {
-                        auto ccd = mUserCache.constFind(user);
-                        if (ccd == mUserCache.cend()) {
-                            usersToFetch.push_back(user);
-                        }
-                    }
-
-                    auto future = Phrary::Maniphest::queryTransactionsByTask(QVector<uint>{ task.id() })
-                        .exec(Phrary::Server(Settings::self()->url(), Settings::self()->aPIToken()));
-                    // FIXME: Nope nope nope nope nope nope nope
-                    future.waitForFinished();
+    QSharedPointer<ItemSyncState> state(new ItemSyncState);
+    state->collection = collection;
+    state->revision = SyncRevision::fromString(collection.remoteRevision());
+    state->newRevision = state->revision;
+    state->startTime = QDateTime::currentDateTimeUtc().toTime_t();
+    state->transferStatistics = mServer.transferStatistics();
+    // Incremental sync cannot notice tasks that were deleted or that we can no
+    // longer see, so once in a while do a full sync to get rid of them
+    state->incremental = state->revision.watermark > 0
+        && state->startTime - state->revision.lastFullSync < static_cast<uint>(Settings::self()->fullSyncInterval()) * 3600;
+    // Descriptions and comments are only fetched for tasks that someone opens
+    state->headersOnly = Settings::self()->lazyTaskPayload();
+
+    // Each page is handed over to Akonadi as soon as it's converted, so we never
+    // have to keep the entire project in memory
+    setItemStreamingEnabled(true);
+    if (state->incremental) {
+        retrieveItemsPage(state, 0);
+        return;
+    }
 
-                    Q_FOREACH (const Phrary::Maniphest::Transaction &trx, future.value()) {
-                        auto author = mUserCache.constFind(trx.authorPHID());
-                        if (author == mUserCache.cend()) {
-                            usersToFetch.push_back(trx.authorPHID());
-                        }
-                    }
+    // Tasks modified while we are paging may end up on a page we have already
+    // fetched, so the watermark is taken before the first page, and the next
+    // incremental sync picks them up
+    const Phrary::Server server = this->server(Phrary::RequestScheduler::LowPriority);
+    TaskSync::fetchWatermark()
+        .then<void, QDateTime>(
+            [this, state](const QDateTime &watermark) {
+                if (watermark.isValid()) {
+                    state->newRevision.watermark = watermark.toTime_t();
+                }
+                retrieveItemsPage(state, 0);
+            },
+            [this](int errorCode, const QString &errorMessage) {
+                Q_UNUSED(errorCode);
+                cancelTask(errorMessage);
+            })
+        .exec(server);
+}
 
-                    if (!usersToFetch.isEmpty()) {
-                        // remove duplicates. They somehow happen and they are expensive
-                        // to fetch
-                        // TODO: Make them not happen in the first place
-                        std::sort(usersToFetch.begin(), usersToFetch.end());
-                        for (auto iter = usersToFetch.begin(), end = usersToFetch.end(); iter != end; end = usersToFetch.end() ) {
-                            auto next = iter;
-                            if (iter == ++next) {
-                                iter = usersToFetch.erase(iter);
-                            } else {
-                                iter = next;
-                            }
-                        }
-                        fetchUsers(usersToFetch);
-                    }
+void PhabricatorResource::retrieveItemsPage(const QSharedPointer<ItemSyncState> &state, int offset)
+{
+    const Phrary::Server server = this->server(Phrary::RequestScheduler::LowPriority);
+    TaskSync::Options options;
+    options.pageSize = Settings::self()->pageSize();
+    options.transactionBatchSize = Settings::self()->transactionBatchSize();
+    options.incremental = state->incremental;
+    options.modifiedSince = QDateTime::fromTime_t(state->revision.watermark);
+    options.headersOnly = state->headersOnly;
+
+    // Tasks are converted as soon as they are ready, while the rest of the
+    // page is still being downloaded
+    QSharedPointer<PageConversion> conversion(new PageConversion);
+    conversion->collection = state->collection;
+    TaskSync::PageHandler onReady;
+    if (!state->headersOnly) {
+        onReady = [this, conversion](const TaskSync::Page &ready) {
+            convertTasks(ready, conversion);
+        };
+    }
 
-                    Akonadi::Item item;
-                    item.setParentCollection(collection);
-                    PhabricatorResource::payloadToItem(task, future.value(), item);
-                    items.push_back(item);
+    TaskSync::fetchPage(state->collection.remoteId(), offset, options, server, &mUserCache, onReady)
+        .then<Akonadi::Item::List, TaskSync::Page>(
+            [this, state, conversion](const TaskSync::Page &page, KAsync::Future<Akonadi::Item::List> &future) {
+                // The incremental query pages from the most recently modified
+                // task, tasks modified while it runs move in front of its first
+                // page and are not older than anything it returned
+                if (state->incremental && page.lastModified.isValid()) {
+                    state->newRevision.watermark = qMax(state->newRevision.watermark,
+                                                        page.lastModified.toTime_t());
                 }
-                return items;
+                state->otherTasks = page.otherTasks;
+                tasksToItems(page, *state, conversion, future);
             })
         .then<void, Akonadi::Item::List>(
-            [this](const Akonadi::Item::List &items) {
+            [this, state, options, offset](const Akonadi::Item::List &items) {
+
+                if (state->incremental) {
+                    qCDebug(LOG) << "Incremental sync of" << state->collection.remoteId() << ":"
+                                 << items.count() << "changed tasks";
+                    retrieveRemovedItems(state, items);
+                    return;
+                }
+
                 itemsRetrieved(items);
+                if (TaskSync::hasNextPage(options, items.size())) {
+                    retrieveItemsPage(state, offset + items.size());
+                    return;
+                }
+                state->newRevision.lastFullSync = state->startTime;
+                finishItemsRetrieval(state);
+            },
+            [this](int errorCode, const QString &errorMessage) {
+                Q_UNUSED(errorCode);
+                cancelTask(errorMessage);
             })
-        .exec(Phrary::Server(Settings::self()->url(), Settings::self()->aPIToken()));
+        .exec(server);
+}
+
+void PhabricatorResource::retrieveRemovedItems(const QSharedPointer<ItemSyncState> &state,
+                                               const Akonadi::Item::List &changedItems)
+{
+    if (state->otherTasks.isEmpty()) {
+        itemsRetrievedIncremental(changedItems, Akonadi::Item::List());
+        finishItemsRetrieval(state);
+        return;
+    }
+
+    // Most of the other tasks are just changes in other projects, only those
+    // we have in the collection were moved out of the project
+    auto job = new Akonadi::ItemFetchJob(state->collection, this);
+    job->fetchScope().setFetchRemoteIdentification(true);
+    job->fetchScope().setFetchModificationTime(false);
+    job->fetchScope().setCacheOnly(true);
+    connect(job, &KJob::result, this, [this, state, changedItems](KJob *job) {
+        if (job->error()) {
+            cancelTask(job->errorString());
+            return;
+        }
+
+        const QSet<QString> otherTasks = state->otherTasks.toSet();
+        Akonadi::Item::List removedItems;
+        Q_FOREACH (const Akonadi::Item &item, static_cast<Akonadi::ItemFetchJob *>(job)->items()) {
+            if (otherTasks.contains(item.remoteId())) {
+                removedItems.push_back(item);
+            }
+        }
+        qCDebug(LOG) << removedItems.count() << "tasks were moved out of" << state->collection.remoteId();
+        itemsRetrievedIncremental(changedItems, removedItems);
+        finishItemsRetrieval(state);
+    });
+}
+
+void PhabricatorResource::finishItemsRetrieval(const QSharedPointer<ItemSyncState> &state)
+{
+    itemsRetrievalDone();
+    invalidatePayloads(state->collection, state->changedRemoteIds);
+    mMarkupCache.save();
+    logTransferStatistics(state->transferStatistics);
+
+    if (!(state->newRevision == state->revision)) {
+        Akonadi::Collection col(state->collection.id());
+        col.setRemoteRevision(state->newRevision.toString());
+        new Akonadi::CollectionModifyJob(col, this);
+    }
 }
 
 AKONADI_RESOURCE_MAIN(PhabricatorResource)
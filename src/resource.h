@@ -25,12 +25,16 @@
 #include <AkonadiAgentBase/ResourceBase>
 
 #include "liphrary/maniphest.h"
+#include "liphrary/server.h"
+#include "usercache.h"
+#include "markupcache.h"
+#include "tasksync.h"
 
+#include <QFuture>
 #include <QHash>
-
-namespace Phrary {
-class User;
-}
+#include <QSharedPointer>
+#include <QStringList>
+#include <QVector>
 
 class PhabricatorResource : public Akonadi::ResourceBase
                           , public Akonadi::AgentBase::Observer
@@ -46,7 +50,17 @@ public:
     void aboutToQuit() Q_DECL_OVERRIDE;
 
     void retrieveCollections() Q_DECL_OVERRIDE;
+
+    /**
+     * The header of a task (summary, priority, status, ...) is stored in a
+     * TaskHeaderAttribute, which Akonadi keeps with the item. The only payload
+     * part is the full todo with the rendered description and comments, so
+     * Akonadi asks for items only when that is missing. retrieveItem() and
+     * retrieveItems() deliberately ignore @p parts and always deliver the
+     * full todo.
+     */
     bool retrieveItem(const Akonadi::Item &item, const QSet<QByteArray> &parts) Q_DECL_OVERRIDE;
+    bool retrieveItems(const Akonadi::Item::List &items, const QSet<QByteArray> &parts) Q_DECL_OVERRIDE;
     void retrieveItems(const Akonadi::Collection &collection) Q_DECL_OVERRIDE;
 
     // This is a read-only resource
@@ -55,14 +69,33 @@ private Q_SLOTS:
     void doReconfigure();
 
 private:
-    static void payloadToItem(const Phrary::Maniphest::Task &task,
-                              const Phrary::Maniphest::Transaction::List &taskTransactions,
-                              Akonadi::Item &item);
+    void headerToItem(const Phrary::Maniphest::Task &task, Akonadi::Item &item) const;
+    void payloadToItem(const Phrary::Maniphest::Task &task,
+                       const Phrary::Maniphest::Transaction::List &taskTransactions,
+                       Akonadi::Item &item);
+
+    struct ItemSyncState;
+    struct PageConversion;
+    void tasksToItems(const TaskSync::Page &page, ItemSyncState &state,
+                      const QSharedPointer<PageConversion> &conversion,
+                      KAsync::Future<Akonadi::Item::List> &future);
+    void convertTasks(const TaskSync::Page &page, const QSharedPointer<PageConversion> &conversion);
+    void finishConversion(const QSharedPointer<PageConversion> &conversion);
+    void retrieveItemsPage(const QSharedPointer<ItemSyncState> &state, int offset);
+    void retrieveRemovedItems(const QSharedPointer<ItemSyncState> &state,
+                              const Akonadi::Item::List &changedItems);
+    void finishItemsRetrieval(const QSharedPointer<ItemSyncState> &state);
+    void invalidatePayloads(const Akonadi::Collection &collection, const QStringList &remoteIds);
 
-    void fetchUsers(const QVector<QByteArray> &userPHIDs);
+    Phrary::Server server(Phrary::RequestScheduler::Priority priority) const;
+    void logTransferStatistics(const QHash<QString, Phrary::TransferStatistics> &since) const;
 
 private:
-    static QHash<QByteArray, Phrary::User> mUserCache;
+    UserCache mUserCache;
+    MarkupCache mMarkupCache;
+    Phrary::Server mServer;
+    // Tasks being converted on the thread pool
+    QVector<QFuture<Akonadi::Item>> mConversions;
 };
 
 #endif // PHABRICATORRESOURCE_H
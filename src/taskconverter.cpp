@@ -0,0 +1,97 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "taskconverter.h"
+#include "usercache.h"
+#include "markupcache.h"
+#include "debug.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QUrl>
+
+#include <KCalCore/Attendee>
+
+#include <KLocalizedString>
+
+QString TaskConverter::summary(const Phrary::Maniphest::Task &task)
+{
+    return QStringLiteral("[%1] %2").arg(QString::fromUtf8(task.objectName()), task.title());
+}
+
+KCalCore::Todo::Ptr TaskConverter::toTodo(const Phrary::Maniphest::Task &task,
+                                          const Phrary::Maniphest::Transaction::List &transactions,
+                                          const UserCache &users, MarkupCache &markup)
+{
+    KCalCore::Todo *todo = new KCalCore::Todo;
+    todo->setUid(QString::fromLatin1(task.phid()));
+    todo->setSummary(summary(task));
+    todo->setCompleted(task.isClosed());
+    todo->setUrl(task.uri());
+    if (task.priority() == Phrary::Maniphest::UnknownPriority) {
+        qCWarning(LOG) << "Unknown priority of task" << task.objectName();
+    }
+    todo->setPriority(Phrary::Maniphest::iCalPriority(task.priority()));
+
+    todo->setOrganizer(users.value(task.authorPHID()).realName());
+    Q_FOREACH (const Phrary::PhidRef &cc, task.ccPHIDs()) {
+        KCalCore::Attendee attee(users.value(cc).realName(), QString());
+        todo->addAttendee(attee);
+    }
+
+    const QString taskDescription = markup.toHTML(task.description());
+    QString description = taskDescription + QStringLiteral("<br><br><hr><br>");
+
+    int commentsCount = 0;
+    // Iterate in reverse order, because Conduit returns transactions in order
+    // from newest to oldest, which makes no sense when displaying comments
+    auto iter = transactions.cend();
+    while (iter != transactions.cbegin()) {
+        --iter;
+        if (iter->transactionType() != "core:comment") {
+            continue;
+        }
+
+        ++commentsCount;
+        if (!users.contains(iter->authorPHID())) {
+            description += i18nc("Header to a task comment: On DATE, unknown user wrote",
+                                 "On %1, unknown user wrote:",
+                                 iter->dateCreated().toString(Qt::LocaleDate));
+        } else {
+            const Phrary::User author = users.value(iter->authorPHID());
+            description += i18nc("Header to a task comment: On DATE, REAL NAME (USERNAME) wrote",
+                                 "On %1, %2 (%3) wrote:",
+                                 iter->dateCreated().toString(Qt::LocalDate),
+                                 author.realName(),
+                                 author.userName());
+        }
+        description += QStringLiteral("<br>%1<br><hr>").arg(markup.toHTML(iter->comments()));
+    }
+    if (commentsCount == 0) {
+        description = taskDescription;
+    }
+    todo->setDescription(description, true);
+
+    // This must be set as last, otherwise all other set* are ignored
+    todo->setReadOnly(true);
+
+    return KCalCore::Todo::Ptr(todo);
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TASKCONVERTER_H
+#define TASKCONVERTER_H
+
+#include <KCalCore/Todo>
+
+#include "liphrary/maniphest.h"
+
+class UserCache;
+class MarkupCache;
+
+/**
+ * Conversion of Maniphest tasks to the KCalCore::Todo payloads of Akonadi items.
+ *
+ * Kept apart from the resource so that the benchmarks run exactly the same code.
+ */
+namespace TaskConverter
+{
+
+QString summary(const Phrary::Maniphest::Task &task);
+
+/**
+ * Converts @p task with its @p transactions (newest first, as returned by
+ * Conduit) to a todo. The users are looked up in @p users and the markup is
+ * rendered through @p markup. May be called from several threads at once,
+ * both caches are thread-safe.
+ */
+KCalCore::Todo::Ptr toTodo(const Phrary::Maniphest::Task &task,
+                           const Phrary::Maniphest::Transaction::List &transactions,
+                           const UserCache &users, MarkupCache &markup);
+
+}
+
+#endif // TASKCONVERTER_H
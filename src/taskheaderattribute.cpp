@@ -0,0 +1,109 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "taskheaderattribute.h"
+
+#include <QDataStream>
+
+TaskHeaderAttribute::TaskHeaderAttribute()
+    : mPriority(0)
+    , mCompleted(false)
+{
+}
+
+TaskHeaderAttribute::~TaskHeaderAttribute()
+{
+}
+
+void TaskHeaderAttribute::setSummary(const QString &summary)
+{
+    mSummary = summary;
+}
+
+QString TaskHeaderAttribute::summary() const
+{
+    return mSummary;
+}
+
+void TaskHeaderAttribute::setPriority(int priority)
+{
+    mPriority = priority;
+}
+
+int TaskHeaderAttribute::priority() const
+{
+    return mPriority;
+}
+
+void TaskHeaderAttribute::setStatus(const QString &status)
+{
+    mStatus = status;
+}
+
+QString TaskHeaderAttribute::status() const
+{
+    return mStatus;
+}
+
+void TaskHeaderAttribute::setCompleted(bool completed)
+{
+    mCompleted = completed;
+}
+
+bool TaskHeaderAttribute::isCompleted() const
+{
+    return mCompleted;
+}
+
+void TaskHeaderAttribute::setUrl(const QUrl &url)
+{
+    mUrl = url;
+}
+
+QUrl TaskHeaderAttribute::url() const
+{
+    return mUrl;
+}
+
+QByteArray TaskHeaderAttribute::type() const
+{
+    static const QByteArray sType("TaskHeader");
+    return sType;
+}
+
+Akonadi::Attribute *TaskHeaderAttribute::clone() const
+{
+    return new TaskHeaderAttribute(*this);
+}
+
+QByteArray TaskHeaderAttribute::serialized() const
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << mSummary << mPriority << mStatus << mCompleted << mUrl;
+    return data;
+}
+
+void TaskHeaderAttribute::deserialize(const QByteArray &data)
+{
+    QDataStream stream(data);
+    stream >> mSummary >> mPriority >> mStatus >> mCompleted >> mUrl;
+}
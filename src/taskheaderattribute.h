@@ -0,0 +1,74 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TASKHEADERATTRIBUTE_H
+#define TASKHEADERATTRIBUTE_H
+
+#include <AkonadiCore/Attribute>
+
+#include <QString>
+#include <QUrl>
+
+/**
+ * The part of a task that list views need: summary, priority and status.
+ *
+ * When the resource is configured to deliver tasks lazily, synchronization
+ * only stores this attribute and the full KCalCore::Todo payload, with the
+ * rendered description and comments, is built when a client asks for it.
+ */
+class TaskHeaderAttribute : public Akonadi::Attribute
+{
+public:
+    TaskHeaderAttribute();
+    ~TaskHeaderAttribute();
+
+    void setSummary(const QString &summary);
+    QString summary() const;
+
+    /**
+     * Priority in the iCal scale, see Phrary::Maniphest::iCalPriority()
+     */
+    void setPriority(int priority);
+    int priority() const;
+
+    void setStatus(const QString &status);
+    QString status() const;
+
+    void setCompleted(bool completed);
+    bool isCompleted() const;
+
+    void setUrl(const QUrl &url);
+    QUrl url() const;
+
+    QByteArray type() const Q_DECL_OVERRIDE;
+    Akonadi::Attribute *clone() const Q_DECL_OVERRIDE;
+    QByteArray serialized() const Q_DECL_OVERRIDE;
+    void deserialize(const QByteArray &data) Q_DECL_OVERRIDE;
+
+private:
+    QString mSummary;
+    int mPriority;
+    QString mStatus;
+    bool mCompleted;
+    QUrl mUrl;
+};
+
+#endif // TASKHEADERATTRIBUTE_H
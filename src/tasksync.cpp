@@ -0,0 +1,404 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "tasksync.h"
+#include "usercache.h"
+#include "debug.h"
+
+#include <QSet>
+#include <QSharedPointer>
+
+#include "liphrary/user.h"
+
+static TaskSync::Page splitModifiedTasks(const QString &projectPHID, const Phrary::Maniphest::Task::List &tasks)
+{
+    // A task moved to another project is modified by the move, so it is among
+    // the changes of the whole server, just not in our project anymore
+    const Phrary::PhidRef project(projectPHID.toLatin1());
+    TaskSync::Page page;
+    for (const auto &task : tasks) {
+        if (task.projectPHIDs().contains(project)) {
+            page.tasks.push_back(task);
+        } else {
+            page.otherTasks.push_back(QString::fromLatin1(task.phid()));
+        }
+        if (!page.lastModified.isValid() || task.dateModified() > page.lastModified) {
+            page.lastModified = task.dateModified();
+        }
+    }
+    return page;
+}
+
+static QVector<Phrary::PhidRef> taskUsers(const Phrary::Maniphest::Task &task,
+                                          const Phrary::Maniphest::Transaction::List &transactions)
+{
+    QVector<Phrary::PhidRef> users = task.ccPHIDs();
+    users.reserve(users.size() + transactions.size() + 1);
+    users.push_back(task.authorPHID());
+    for (const auto &trx : transactions) {
+        users.push_back(trx.authorPHID());
+    }
+    return users;
+}
+
+namespace {
+
+/**
+ * Transactions of a page, fetched in batches. Batches are sent as soon as
+ * they are full, even while the tasks of the page are still being received.
+ */
+struct TransactionFetch
+{
+    TransactionFetch(const Phrary::Server &server, int batchSize, UserCache *users,
+                     const TaskSync::PageHandler &onReady, const KAsync::Future<TaskSync::Page> &future)
+        : server(server)
+        , batchSize(qMax(1, batchSize))
+        , users(users)
+        , onReady(onReady)
+        , future(future)
+        , receivedTasks(0)
+        , runningBatches(0)
+        , complete(false)
+        , failed(false)
+    {
+    }
+
+    Phrary::Server server;
+    int batchSize;
+    UserCache *users;
+    TaskSync::PageHandler onReady;
+    KAsync::Future<TaskSync::Page> future;
+    TaskSync::Page page;
+    // Received tasks that have not been reported to onReady yet
+    QHash<uint, Phrary::Maniphest::Task> pendingTasks;
+    QVector<uint> batch;
+    int receivedTasks;
+    int runningBatches;
+    bool complete;
+    bool failed;
+};
+
+typedef QSharedPointer<TransactionFetch> TransactionFetchPtr;
+
+}
+
+static void reportReadyTask(const TransactionFetchPtr &fetch, uint taskId)
+{
+    const auto it = fetch->pendingTasks.find(taskId);
+    if (it == fetch->pendingTasks.end()) {
+        return;
+    }
+
+    // Tasks that still need some users are only returned with the page,
+    // after fetchMissingUsers()
+    const Phrary::Maniphest::Transaction::List transactions = fetch->page.transactions.value(taskId);
+    Q_FOREACH (const Phrary::PhidRef &user, taskUsers(*it, transactions)) {
+        if (!user.isEmpty() && !fetch->users->contains(user)) {
+            return;
+        }
+    }
+
+    TaskSync::Page ready;
+    ready.tasks.push_back(*it);
+    ready.transactions.insert(taskId, transactions);
+    fetch->pendingTasks.erase(it);
+    fetch->onReady(ready);
+}
+
+static void finishTransactionFetch(const TransactionFetchPtr &fetch)
+{
+    if (fetch->failed || !fetch->complete || fetch->runningBatches > 0) {
+        return;
+    }
+    auto f = fetch->future;
+    f.setValue(fetch->page);
+    f.setFinished();
+}
+
+static void failTransactionFetch(const TransactionFetchPtr &fetch, int errorCode, const QString &errorMessage)
+{
+    if (fetch->failed) {
+        return;
+    }
+    fetch->failed = true;
+    auto f = fetch->future;
+    f.setError(errorCode, errorMessage);
+}
+
+static void fetchTransactionBatch(const TransactionFetchPtr &fetch)
+{
+    const QVector<uint> taskIds = fetch->batch;
+    fetch->batch.clear();
+    ++fetch->runningBatches;
+
+    // All batches are sent right away, the server scheduler decides how many
+    // of them actually run in parallel
+    auto watcher = new KAsync::FutureWatcher<Phrary::Maniphest::Transaction::List>();
+    QObject::connect(watcher, &KAsync::FutureWatcherBase::futureReady,
+        [watcher, fetch, taskIds]() {
+            const auto trxFuture = watcher->future();
+            watcher->deleteLater();
+            --fetch->runningBatches;
+            if (fetch->failed) {
+                return;
+            }
+            if (trxFuture.errorCode()) {
+                failTransactionFetch(fetch, trxFuture.errorCode(), trxFuture.errorMessage());
+                return;
+            }
+
+            // Tasks without any transactions have not been reported yet
+            if (fetch->onReady) {
+                for (uint taskId : taskIds) {
+                    reportReadyTask(fetch, taskId);
+                }
+            }
+            finishTransactionFetch(fetch);
+        });
+    watcher->setFuture(Phrary::Maniphest::queryTransactionsByTask(taskIds,
+            [fetch](const Phrary::Maniphest::Transaction::List &trxs) {
+                if (fetch->failed) {
+                    return;
+                }
+                // Conduit returns the transactions keyed by task, from newest
+                // to oldest, so each call has all the transactions of one task
+                const uint taskId = static_cast<uint>(trxs.first().taskId());
+                fetch->page.transactions.insert(taskId, trxs);
+                if (fetch->onReady) {
+                    reportReadyTask(fetch, taskId);
+                }
+            })
+        .exec(fetch->server));
+}
+
+static void addTasks(const TransactionFetchPtr &fetch, const Phrary::Maniphest::Task::List &tasks)
+{
+    fetch->receivedTasks += tasks.size();
+    for (const auto &task : tasks) {
+        if (fetch->onReady) {
+            fetch->pendingTasks.insert(task.id(), task);
+        }
+        fetch->batch.push_back(task.id());
+        if (fetch->batch.size() >= fetch->batchSize) {
+            fetchTransactionBatch(fetch);
+        }
+    }
+}
+
+static void completeTasks(const TransactionFetchPtr &fetch, const Phrary::Maniphest::Task::List &tasks)
+{
+    // Anything that was not reported while being received
+    addTasks(fetch, tasks.mid(fetch->receivedTasks));
+    fetch->page.tasks = tasks;
+    fetch->complete = true;
+    if (!fetch->batch.isEmpty()) {
+        fetchTransactionBatch(fetch);
+    }
+    finishTransactionFetch(fetch);
+}
+
+KAsync::Job<TaskSync::Page, Phrary::Server> TaskSync::fetchPage(const QString &projectPHID, int offset,
+                                                                const Options &options,
+                                                                const Phrary::Server &server,
+                                                                UserCache *users,
+                                                                const PageHandler &onReady)
+{
+    const int batchSize = options.transactionBatchSize;
+
+    // Changes since the last sync are expected to be few, so the incremental
+    // sync fetches them all at once
+    if (options.incremental) {
+        auto tasksJob = Phrary::Maniphest::queryTasksByProjectModifiedSince(QString(), options.modifiedSince)
+            .then<Page, Phrary::Maniphest::Task::List>(
+                [projectPHID](const Phrary::Maniphest::Task::List &tasks) -> Page {
+                    return splitModifiedTasks(projectPHID, tasks);
+                });
+        if (options.headersOnly) {
+            return tasksJob;
+        }
+        return tasksJob
+            .then<Page, Page>(
+                [server, batchSize, users, onReady](const Page &page, KAsync::Future<Page> &future) {
+                    fetchTransactions(server, page, batchSize, users, onReady, future);
+                })
+            .then<Page, Page>(
+                [server, users](const Page &page, KAsync::Future<Page> &future) {
+                    fetchMissingUsers(server, page, users, future);
+                });
+    }
+
+    // The full sync is ordered by creation time, so that tasks created while
+    // we are paging only cause a task to be seen twice, instead of being skipped
+    const int pageSize = qMax(1, options.pageSize);
+    if (options.headersOnly) {
+        return Phrary::Maniphest::queryTasksByProject(projectPHID, offset, pageSize, Phrary::Maniphest::OrderByCreated)
+            .then<Page, Phrary::Maniphest::Task::List>(
+                [](const Phrary::Maniphest::Task::List &tasks) -> Page {
+                    Page page;
+                    page.tasks = tasks;
+                    return page;
+                });
+    }
+
+    // Each batch of transactions is requested as soon as its tasks have been
+    // received, while the rest of the page is still being downloaded
+    return KAsync::start<Page, Phrary::Server>(
+        [projectPHID, offset, pageSize, batchSize, users, onReady](const Phrary::Server &server,
+                                                                   KAsync::Future<Page> &future) {
+            const TransactionFetchPtr fetch(new TransactionFetch(server, batchSize, users, onReady, future));
+            auto watcher = new KAsync::FutureWatcher<Phrary::Maniphest::Task::List>();
+            QObject::connect(watcher, &KAsync::FutureWatcherBase::futureReady,
+                [watcher, fetch]() {
+                    const auto tasksFuture = watcher->future();
+                    watcher->deleteLater();
+                    if (tasksFuture.errorCode()) {
+                        failTransactionFetch(fetch, tasksFuture.errorCode(), tasksFuture.errorMessage());
+                    } else {
+                        completeTasks(fetch, tasksFuture.value());
+                    }
+                });
+            watcher->setFuture(Phrary::Maniphest::queryTasksByProject(projectPHID, offset, pageSize,
+                                                                      Phrary::Maniphest::OrderByCreated,
+                    [fetch](const Phrary::Maniphest::Task::List &tasks) {
+                        addTasks(fetch, tasks);
+                    })
+                .exec(server));
+        })
+        .then<Page, Page>(
+            [server, users](const Page &page, KAsync::Future<Page> &future) {
+                fetchMissingUsers(server, page, users, future);
+            });
+}
+
+KAsync::Job<QDateTime, Phrary::Server> TaskSync::fetchWatermark()
+{
+    return Phrary::Maniphest::queryTasksByProject(QString(), 0, 1, Phrary::Maniphest::OrderByModified)
+        .then<QDateTime, Phrary::Maniphest::Task::List>(
+            [](const Phrary::Maniphest::Task::List &tasks) -> QDateTime {
+                return tasks.isEmpty() ? QDateTime() : tasks.first().dateModified();
+            });
+}
+
+bool TaskSync::hasNextPage(const Options &options, int pageSize)
+{
+    // Don't rely on short pages, the server may cap the page size below what
+    // we asked for
+    return !options.incremental && pageSize > 0;
+}
+
+KAsync::Job<TaskSync::Page, Phrary::Server> TaskSync::fetchTasks(const QStringList &phids,
+                                                                 const Phrary::Server &server,
+                                                                 UserCache *users)
+{
+    // Someone is waiting for these tasks, so all of their transactions are
+    // fetched in a single request
+    return Phrary::Maniphest::queryTasksByPHID(phids)
+        .then<Page, Phrary::Maniphest::Task::List>(
+            [server, users](const Phrary::Maniphest::Task::List &tasks, KAsync::Future<Page> &future) {
+                Page page;
+                page.tasks = tasks;
+                fetchTransactions(server, page, tasks.size(), users, PageHandler(), future);
+            })
+        .then<Page, Page>(
+            [server, users](const Page &page, KAsync::Future<Page> &future) {
+                fetchMissingUsers(server, page, users, future);
+            });
+}
+
+void TaskSync::fetchTransactions(const Phrary::Server &server,
+                                 const Page &page,
+                                 int batchSize,
+                                 UserCache *users,
+                                 const PageHandler &onReady,
+                                 KAsync::Future<Page> &future)
+{
+    const TransactionFetchPtr fetch(new TransactionFetch(server, batchSize, users, onReady, future));
+    fetch->page = page;
+    addTasks(fetch, page.tasks);
+    completeTasks(fetch, page.tasks);
+}
+
+void TaskSync::fetchMissingUsers(const Phrary::Server &server,
+                                 const Page &page,
+                                 UserCache *users,
+                                 KAsync::Future<Page> &future)
+{
+    // Collect users of the entire page, so that they can be resolved at once
+    QSet<Phrary::PhidRef> usersToFetch;
+    QSet<Phrary::PhidRef> usersToRefresh;
+    const auto checkUser = [users, &usersToFetch, &usersToRefresh](const Phrary::PhidRef &phid) {
+        if (phid.isEmpty()) {
+            return;
+        } else if (!users->contains(phid)) {
+            usersToFetch.insert(phid);
+        } else if (users->isStale(phid)) {
+            usersToRefresh.insert(phid);
+        }
+    };
+
+    for (const auto &task : page.tasks) {
+        Q_FOREACH (const Phrary::PhidRef &user, taskUsers(task, page.transactions.value(task.id()))) {
+            checkUser(user);
+        }
+    }
+
+    // Stale users are still good enough to build the items, refresh them
+    // in the background
+    if (!usersToRefresh.isEmpty()) {
+        auto watcher = new KAsync::FutureWatcher<Phrary::User::List>();
+        QObject::connect(watcher, &KAsync::FutureWatcherBase::futureReady,
+            [users, watcher]() {
+                const auto usersFuture = watcher->future();
+                watcher->deleteLater();
+                if (!usersFuture.errorCode()) {
+                    Q_FOREACH (const Phrary::User &user, usersFuture.value()) {
+                        users->insert(user);
+                    }
+                }
+            });
+        watcher->setFuture(Phrary::User::query(usersToRefresh.toList().toVector()).exec(server));
+    }
+
+    if (usersToFetch.isEmpty()) {
+        future.setValue(page);
+        future.setFinished();
+        return;
+    }
+
+    auto watcher = new KAsync::FutureWatcher<Phrary::User::List>();
+    QObject::connect(watcher, &KAsync::FutureWatcherBase::futureReady,
+        [users, watcher, page, future]() {
+            auto f = future;
+            const auto usersFuture = watcher->future();
+            watcher->deleteLater();
+            if (usersFuture.errorCode()) {
+                // Not fatal, the users will just show up as unknown
+                qCWarning(LOG) << "Failed to fetch users:" << usersFuture.errorMessage();
+            } else {
+                Q_FOREACH (const Phrary::User &user, usersFuture.value()) {
+                    users->insert(user);
+                }
+            }
+            f.setValue(page);
+            f.setFinished();
+        });
+    watcher->setFuture(Phrary::User::query(usersToFetch.toList().toVector()).exec(server));
+}
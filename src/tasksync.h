@@ -0,0 +1,148 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TASKSYNC_H
+#define TASKSYNC_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QStringList>
+
+#include <KAsync/Async>
+
+#include <functional>
+
+#include "liphrary/maniphest.h"
+#include "liphrary/server.h"
+
+class UserCache;
+
+/**
+ * Fetching of project tasks together with everything needed to convert them:
+ * their transactions and the users they refer to.
+ *
+ * Kept apart from the resource so that the benchmarks page through a project
+ * exactly the way a sync does.
+ */
+namespace TaskSync
+{
+
+struct Page {
+    Phrary::Maniphest::Task::List tasks;
+    QHash<uint, Phrary::Maniphest::Transaction::List> transactions;
+    /**
+     * Incremental sync only: PHIDs of the tasks modified since
+     * Options::modifiedSince that are not in the project (anymore). Those we
+     * have seen in the project before have been moved out of it.
+     */
+    QStringList otherTasks;
+    /**
+     * Incremental sync only: the most recent dateModified of all the tasks
+     * the query returned, including otherTasks. Invalid when nothing changed.
+     */
+    QDateTime lastModified;
+};
+
+struct Options {
+    Options()
+        : pageSize(100)
+        , transactionBatchSize(50)
+        , incremental(false)
+        , headersOnly(false)
+    {
+    }
+
+    int pageSize;
+    int transactionBatchSize;
+    /**
+     * Fetch only the tasks modified at or after modifiedSince, all in one page.
+     *
+     * The tasks are queried across all projects, so that the tasks moved out
+     * of the project show up in Page::otherTasks. Tasks that were deleted or
+     * that we can no longer see are not returned by Conduit at all, and are
+     * only noticed by the next full sync.
+     */
+    bool incremental;
+    QDateTime modifiedSince;
+    /**
+     * Fetch only the tasks, without transactions and users.
+     */
+    bool headersOnly;
+};
+
+/**
+ * Called with a task and its transactions as soon as the task can be
+ * converted, while the rest of the page is still being fetched. Tasks that
+ * refer to users missing from the UserCache are not reported, they are only
+ * complete once the page is returned.
+ */
+typedef std::function<void(const Page &)> PageHandler;
+
+/**
+ * Fetches the page of tasks of @p projectPHID starting at @p offset. Missing
+ * users are fetched into @p users before the page is returned.
+ *
+ * If @p onReady is set, it is called with each task that is ready before the
+ * page is. The returned page still contains all the tasks. In the
+ * headers-only mode the tasks are only returned with the page.
+ */
+KAsync::Job<Page, Phrary::Server> fetchPage(const QString &projectPHID, int offset,
+                                            const Options &options,
+                                            const Phrary::Server &server,
+                                            UserCache *users,
+                                            const PageHandler &onReady = PageHandler());
+
+/**
+ * Returns the dateModified of the most recently modified task on the server,
+ * or an invalid QDateTime when there are no tasks.
+ *
+ * Fetched before the first page of a full sync, so that the tasks modified
+ * while we are paging are picked up again by the next incremental sync.
+ */
+KAsync::Job<QDateTime, Phrary::Server> fetchWatermark();
+
+/**
+ * Returns whether another page follows a page of @p pageSize tasks. The next
+ * page starts at the offset of the current one plus @p pageSize.
+ */
+bool hasNextPage(const Options &options, int pageSize);
+
+/**
+ * Fetches the tasks with the given PHIDs with all their transactions in a single request.
+ */
+KAsync::Job<Page, Phrary::Server> fetchTasks(const QStringList &phids,
+                                             const Phrary::Server &server,
+                                             UserCache *users);
+
+void fetchTransactions(const Phrary::Server &server,
+                       const Page &page,
+                       int batchSize,
+                       UserCache *users,
+                       const PageHandler &onReady,
+                       KAsync::Future<Page> &future);
+void fetchMissingUsers(const Phrary::Server &server,
+                       const Page &page,
+                       UserCache *users,
+                       KAsync::Future<Page> &future);
+
+}
+
+#endif // TASKSYNC_H
@@ -0,0 +1,187 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "usercache.h"
+#include "debug.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStringList>
+#include <QThread>
+#include <QUrl>
+
+static const quint32 CacheMagic = 0x50485543; // "PHUC"
+static const quint32 CacheVersion = 2;
+// The oldest Qt we support, so the file doesn't depend on the Qt we are built with
+static const QDataStream::Version StreamVersion = QDataStream::Qt_5_3;
+
+UserCache::UserCache(QObject *parent)
+    : QObject(parent)
+    , mTimeToLive(7 * 24 * 3600)
+{
+    // Don't write the cache after each single batch of users
+    mSaveTimer.setSingleShot(true);
+    mSaveTimer.setInterval(5000);
+    connect(&mSaveTimer, &QTimer::timeout, this, &UserCache::save);
+}
+
+UserCache::~UserCache()
+{
+    if (mSaveTimer.isActive()) {
+        save();
+    }
+}
+
+void UserCache::setFileName(const QString &fileName)
+{
+    mFileName = fileName;
+}
+
+QString UserCache::fileName() const
+{
+    return mFileName;
+}
+
+void UserCache::setTimeToLive(int seconds)
+{
+    mTimeToLive = seconds;
+}
+
+int UserCache::timeToLive() const
+{
+    return mTimeToLive;
+}
+
+bool UserCache::contains(const Phrary::PhidRef &phid) const
+{
+    QReadLocker locker(&mLock);
+    return mUsers.contains(phid);
+}
+
+bool UserCache::isStale(const Phrary::PhidRef &phid) const
+{
+    QReadLocker locker(&mLock);
+    auto it = mUsers.constFind(phid);
+    if (it == mUsers.cend()) {
+        return false;
+    }
+    return it->fetched.secsTo(QDateTime::currentDateTimeUtc()) > mTimeToLive;
+}
+
+Phrary::User UserCache::value(const Phrary::PhidRef &phid) const
+{
+    QReadLocker locker(&mLock);
+    return mUsers.value(phid).user;
+}
+
+void UserCache::insert(const Phrary::User &user)
+{
+    Q_ASSERT(thread() == QThread::currentThread());
+    {
+        QWriteLocker locker(&mLock);
+        mUsers.insert(user.phid(), Entry{ user, QDateTime::currentDateTimeUtc() });
+    }
+    if (!mFileName.isEmpty() && !mSaveTimer.isActive()) {
+        mSaveTimer.start();
+    }
+}
+
+void UserCache::load()
+{
+    if (mFileName.isEmpty()) {
+        return;
+    }
+
+    QFile file(mFileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(StreamVersion);
+    quint32 magic, version;
+    stream >> magic >> version;
+    if (magic != CacheMagic || version != CacheVersion) {
+        qCWarning(LOG) << "Ignoring user cache" << mFileName << "with unknown format";
+        return;
+    }
+
+    QWriteLocker locker(&mLock);
+    quint32 count;
+    stream >> count;
+    mUsers.reserve(count);
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        Phrary::PhidRef phid;
+        QString userName, realName;
+        QUrl image, uri;
+        QStringList roles;
+        QDateTime fetched;
+        stream >> phid >> userName >> realName >> image >> uri >> roles >> fetched;
+
+        Phrary::User user;
+        user.setPHID(phid);
+        user.setUserName(userName);
+        user.setRealName(realName);
+        user.setImage(image);
+        user.setUri(uri);
+        user.setRoles(roles);
+        mUsers.insert(phid, Entry{ user, fetched });
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(LOG) << "User cache" << mFileName << "is corrupted, discarding it";
+        mUsers.clear();
+        return;
+    }
+
+    qCDebug(LOG) << "Loaded" << mUsers.size() << "users from" << mFileName;
+}
+
+void UserCache::save()
+{
+    mSaveTimer.stop();
+    if (mFileName.isEmpty()) {
+        return;
+    }
+
+    QDir().mkpath(QFileInfo(mFileName).absolutePath());
+    QSaveFile file(mFileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(LOG) << "Failed to open user cache" << mFileName << "for writing:" << file.errorString();
+        return;
+    }
+
+    QReadLocker locker(&mLock);
+    QDataStream stream(&file);
+    stream.setVersion(StreamVersion);
+    stream << CacheMagic << CacheVersion << static_cast<quint32>(mUsers.size());
+    for (auto it = mUsers.cbegin(), end = mUsers.cend(); it != end; ++it) {
+        const Phrary::User &user = it->user;
+        stream << user.phid() << user.userName() << user.realName() << user.image()
+               << user.uri() << user.roles() << it->fetched;
+    }
+
+    if (!file.commit()) {
+        qCWarning(LOG) << "Failed to write user cache" << mFileName << ":" << file.errorString();
+    }
+}
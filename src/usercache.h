@@ -0,0 +1,83 @@
+/*
+ * Copyright 2015  Daniel Vrátil <dvratil@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef USERCACHE_H
+#define USERCACHE_H
+
+#include <QObject>
+#include <QHash>
+#include <QDateTime>
+#include <QReadWriteLock>
+#include <QTimer>
+
+#include "liphrary/user.h"
+
+/**
+ * Cache of Phabricator users that survives restarts of the resource.
+ *
+ * The whole cache is loaded from disk at once when the resource starts and
+ * written back shortly after it changes. Users older than timeToLive() are
+ * still returned, but reported as stale so that they can be refreshed
+ * without blocking the sync on them.
+ *
+ * Users can be looked up from any thread, for instance while items are being
+ * converted on the thread pool. Users are inserted from the main thread only.
+ */
+class UserCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit UserCache(QObject *parent = Q_NULLPTR);
+    ~UserCache();
+
+    void setFileName(const QString &fileName);
+    QString fileName() const;
+
+    /**
+     * Time in seconds after which a cached user is considered stale.
+     */
+    void setTimeToLive(int seconds);
+    int timeToLive() const;
+
+    bool contains(const Phrary::PhidRef &phid) const;
+    bool isStale(const Phrary::PhidRef &phid) const;
+    Phrary::User value(const Phrary::PhidRef &phid) const;
+
+    void insert(const Phrary::User &user);
+
+    void load();
+    void save();
+
+private:
+    struct Entry {
+        Phrary::User user;
+        QDateTime fetched;
+    };
+
+    mutable QReadWriteLock mLock;
+    QHash<Phrary::PhidRef, Entry> mUsers;
+    QString mFileName;
+    int mTimeToLive;
+    QTimer mSaveTimer;
+};
+
+#endif // USERCACHE_H